@@ -1,33 +1,90 @@
 #include <iostream>
+#include <cstring>
+#include <stdexcept>
 #include "assets/gtlf_loader.h"
 #include "shading/materials/all.h"
 #include "shading/texture.h"
+#include "shading/texture_loader.h"
+#include "util/mapped_file.h"
+
+//keeps the encoded image, it is decoded later on the thread pool
+static bool keep_encoded_image(tinygltf::Image* image, const int, std::string*, std::string*, int, int, const unsigned char* bytes, int size, void*){
+    image->image.assign(bytes, bytes + size);
+    image->as_is = true;
+    return true;
+}
+
+//drops the encoded image, for loading the geometry only
+static bool skip_image(tinygltf::Image*, const int, std::string*, std::string*, int, int, const unsigned char*, int, void*){
+    return true;
+}
 
-TextureMap* load_gltf_image(tinygltf::Image &gltf_image, bool convert_linear){
-    TextureMap* texture_map = new TextureMap();
-
-    texture_map->w = gltf_image.width;
-    texture_map->h = gltf_image.height;
-    texture_map->n = gltf_image.component;
-    texture_map->data = new glm::vec3[gltf_image.width * gltf_image.height];
-    auto image_data = gltf_image.image.data();
-
-    for (int i = 0; i < gltf_image.width * gltf_image.height; i++){
-        float r = image_data[i * gltf_image.component + 0]/255.0f;
-        float g = image_data[i * gltf_image.component + 1]/255.0f;
-        float b = image_data[i * gltf_image.component + 2]/255.0f;
-        glm::vec3 color(r, g, b);
-        if (convert_linear){
-            color = glm::pow(color, glm::vec3(2.2f)); // linear space
+/*
+Queues the decode of an image on the texture loader. Images in their own
+file are keyed and tiled by that file, so gltf files and scenes referencing
+it share one texture, embedded ones by the gltf file and image index.
+*/
+std::shared_ptr<TextureMap> load_gltf_image(const tinygltf::Image& gltf_image, std::shared_ptr<std::vector<unsigned char>> encoded, TextureUsage usage, const std::string& filepath, int image_index, TextureLoader& textures){
+    std::string source = filepath + ".image" + std::to_string(image_index);
+    std::string modified = filepath;
+    if (!gltf_image.uri.empty() && gltf_image.uri.compare(0, 5, "data:") != 0){
+        source = TextureLoader::canonical_path(filepath.substr(0, filepath.find_last_of("\\/") + 1) + gltf_image.uri);
+        modified = source;
+    }
+    return textures.load(source, usage, [encoded, usage, source, modified](){
+        auto decode = [&](){
+            TextureMap* map = TextureMap::decode_memory(encoded->data(), encoded->size(), usage);
+            if (map == nullptr){
+                throw std::runtime_error("failed to decode glTF image " + source);
+            }
+            return map;
+        };
+        if (TextureCache::global().enabled()){
+            return TextureMap::load_paged(TextureMap::tiled_path(source, usage), modified, decode);
         }
-        texture_map->data[i] = color;
+        return decode();
+    });
+}
+
+
+//first element of an accessor and the bytes from one element to the next
+static const unsigned char* accessor_data(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t& stride){
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto &buffer = model.buffers[bufferView.buffer];
+    stride = accessor.ByteStride(bufferView);
+    return buffer.data.data() + bufferView.byteOffset + accessor.byteOffset;
+}
+
+//accessor elements stored as T, copied in one go when tightly packed
+template <typename T>
+static void read_accessor(const tinygltf::Model& model, const tinygltf::Accessor& accessor, std::vector<T>& out){
+    size_t stride;
+    const unsigned char* data = accessor_data(model, accessor, stride);
+    out.resize(accessor.count);
+    if (stride == sizeof(T)){
+        std::memcpy(out.data(), data, accessor.count * sizeof(T));
+        return;
+    }
+    for (size_t i = 0; i < accessor.count; i++){
+        std::memcpy(&out[i], data + i * stride, sizeof(T));
     }
-    return texture_map;
 }
 
+//8 and 16 bit indices widened to 32 bits
+template <typename T>
+static void read_indices(const tinygltf::Model& model, const tinygltf::Accessor& accessor, std::vector<unsigned int>& out){
+    size_t stride;
+    const unsigned char* data = accessor_data(model, accessor, stride);
+    out.resize(accessor.count);
+    for (size_t i = 0; i < accessor.count; i++){
+        T value;
+        std::memcpy(&value, data + i * stride, sizeof(T));
+        out[i] = value;
+    }
+}
 
 //based on https://github.com/syoyo/tinygltf/blob/master/examples/raytrace/gltf-loader.cc
-std::vector<Mesh> load_gltf(std::string filepath){
+std::vector<Mesh> load_gltf(std::string filepath, TextureLoader* textures){
     auto meshes = std::vector<Mesh>();
 
     std::cout << "loading gltf file " << filepath << std::endl;
@@ -36,9 +93,20 @@ std::vector<Mesh> load_gltf(std::string filepath){
     tinygltf::TinyGLTF loader;
     std::string err;
     std::string warn;
-
-    bool ret = loader.LoadASCIIFromFile(&model, &err, &warn, filepath);
-    //bool ret = loader.LoadBinaryFromFile(&model, &err, &warn, argv[1]); // for binary glTF(.glb)
+    loader.SetImageLoader(textures != nullptr ? keep_encoded_image : skip_image, nullptr);
+
+    //parsed straight from the mapping, binary files (.glb) by their magic
+    MappedFile file;
+    std::string base_dir = filepath.substr(0, filepath.find_last_of("\\/") + 1);
+    bool ret = false;
+    if (!file.open(filepath)){
+        err = "could not open " + filepath;
+    } else if (file.size() >= 4 && std::memcmp(file.data(), "glTF", 4) == 0){
+        ret = loader.LoadBinaryFromMemory(&model, &err, &warn, file.data(), file.size(), base_dir);
+    } else {
+        ret = loader.LoadASCIIFromString(&model, &err, &warn, (const char*) file.data(), file.size(), base_dir);
+    }
+    file.close();
     if (!warn.empty()) {
         std::cout << "glTF parse warning: " << warn << std::endl;
     }
@@ -48,6 +116,7 @@ std::vector<Mesh> load_gltf(std::string filepath){
     }
     if (!ret) {
         std::cerr << "Failed to load glTF: " << filepath << std::endl;
+        return meshes;
     }
 
     /*
@@ -68,6 +137,12 @@ std::vector<Mesh> load_gltf(std::string filepath){
                 << model.lights.size()   << " lights\n";
     */
 
+    //shared by the decode tasks, which outlive the model
+    std::vector<std::shared_ptr<std::vector<unsigned char>>> encoded;
+    for (tinygltf::Image& image : model.images){
+        encoded.push_back(std::make_shared<std::vector<unsigned char>>(std::move(image.image)));
+    }
+
     auto materials = std::vector<Material*>();
 
     for (const auto gltf_material: model.materials){
@@ -78,96 +153,86 @@ std::vector<Mesh> load_gltf(std::string filepath){
         auto &pbr_metallic_roughness = gltf_material.pbrMetallicRoughness;
         auto &base_color_texture_info = pbr_metallic_roughness.baseColorTexture;
 
-        if (base_color_texture_info.index != -1){
+        if (base_color_texture_info.index != -1 && textures != nullptr){
             auto &gltf_texture = model.textures[base_color_texture_info.index];
             auto &gltf_image = model.images[gltf_texture.source];
 
-            auto texture_map = load_gltf_image(gltf_image, true);
+            auto texture_map = load_gltf_image(gltf_image, encoded[gltf_texture.source], TextureUsage::Color, filepath, gltf_texture.source, *textures);
             material->albedo_texture = texture_map;
         }
 
         //normal map
         auto &normal_texture_info = gltf_material.normalTexture;
-        if (normal_texture_info.index != -1){
+        if (normal_texture_info.index != -1 && textures != nullptr){
             auto &gltf_texture = model.textures[normal_texture_info.index];
             auto &gltf_image = model.images[gltf_texture.source];
 
-            auto texture_map = load_gltf_image(gltf_image, false);
+            auto texture_map = load_gltf_image(gltf_image, encoded[gltf_texture.source], TextureUsage::Normal, filepath, gltf_texture.source, *textures);
             material->normal_texture = texture_map;
         }
         materials.push_back(material);
     }
 
 
+    size_t primitives = 0;
+    for (const auto &gltfMesh : model.meshes) {
+        primitives += gltfMesh.primitives.size();
+    }
+    meshes.reserve(primitives);
+
     for (const auto &gltfMesh : model.meshes) {
         for (const auto &meshPrimitive : gltfMesh.primitives) {
 
             Mesh mesh;
 
             mesh.material = materials[meshPrimitive.material];
-            
-            //mesh indices
-            const auto &indicesAccessor = model.accessors[meshPrimitive.indices];
-            const auto &bufferView = model.bufferViews[indicesAccessor.bufferView];
-            const auto &buffer = model.buffers[bufferView.buffer];
-            const auto dataAddress = buffer.data.data() + bufferView.byteOffset + indicesAccessor.byteOffset;
-            const auto byteStride = indicesAccessor.ByteStride(bufferView);
-            const auto count = indicesAccessor.count;
-
-            IntArrayAdapterBase* indices;
-
-            switch (indicesAccessor.componentType) {
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                    indices = new IntArrayAdapter<unsigned short>(dataAddress, byteStride, count);
-                    break;
-                break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                    indices = new IntArrayAdapter<unsigned int>(dataAddress, byteStride, count);
-                    break;
-                break;
-                default:
-                    std::cout << "unsupported indices type" << indicesAccessor.componentType << std::endl;
-                    return meshes;
-                break;
-
-            }
-
-            for (int i = 0; i < count; i++) {
-                mesh.face_indices.push_back(indices->get(i));
-            }
 
-            //mesh attributes
+            //each array is sized once and filled by one copy when the accessor is tightly packed
             for (const auto &attribute : meshPrimitive.attributes) {
-                
-                const auto attribAccessor = model.accessors[attribute.second];
-                const auto &bufferView = model.bufferViews[attribAccessor.bufferView];
-                const auto &buffer = model.buffers[bufferView.buffer];
-                const auto dataPtr = buffer.data.data() + bufferView.byteOffset + attribAccessor.byteOffset;
-                const auto byte_stride = attribAccessor.ByteStride(bufferView);
-                const auto count = attribAccessor.count;
-
-                if  (attribute.first == "POSITION") {
-                    Vec3ArrayAdapter *positions = new Vec3ArrayAdapter(dataPtr, byte_stride, count);
-                    for (int i = 0; i < count; i++) {
-                        mesh.vertices.push_back(positions->get(i));
-                    }
-                } else if  (attribute.first == "NORMAL") {
-                    Vec3ArrayAdapter *normals = new Vec3ArrayAdapter(dataPtr, byte_stride, count);
-                    for (int i = 0; i < count; i++) {
-                        mesh.normals.push_back(normals->get(i));
-                    }
+                const auto &accessor = model.accessors[attribute.second];
+                if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT) {
+                    std::cout << "unsupported " << attribute.first << " type " << accessor.componentType << std::endl;
+                    continue;
+                }
+                if (attribute.first == "POSITION") {
+                    read_accessor(model, accessor, mesh.vertices);
+                } else if (attribute.first == "NORMAL") {
+                    read_accessor(model, accessor, mesh.normals);
                 } else if (attribute.first == "TEXCOORD_0") {
-                    Vec2ArrayAdapter *tex_coords = new Vec2ArrayAdapter(dataPtr, byte_stride, count);
-                    for (int i = 0; i < count; i++) {
-                        auto uv = tex_coords->get(i);
+                    read_accessor(model, accessor, mesh.tex_coords);
+                    for (glm::vec2& uv : mesh.tex_coords) {
                         uv.y = 1.0f - uv.y;
-                        mesh.tex_coords.push_back(uv);
                     }
                 }
             }
+
+            //mesh indices, unindexed primitives list their vertices in order
+            if (meshPrimitive.indices < 0) {
+                mesh.face_indices.resize(mesh.vertices.size());
+                for (size_t i = 0; i < mesh.face_indices.size(); i++) {
+                    mesh.face_indices[i] = i;
+                }
+            } else {
+                const auto &indicesAccessor = model.accessors[meshPrimitive.indices];
+                switch (indicesAccessor.componentType) {
+                    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                        read_indices<unsigned char>(model, indicesAccessor, mesh.face_indices);
+                        break;
+                    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                        read_indices<unsigned short>(model, indicesAccessor, mesh.face_indices);
+                        break;
+                    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+                        read_accessor(model, indicesAccessor, mesh.face_indices);
+                        break;
+                    default:
+                        std::cout << "unsupported indices type" << indicesAccessor.componentType << std::endl;
+                        return meshes;
+                }
+            }
+
             mesh.compute_tangents();
-            meshes.push_back(mesh);
+            meshes.push_back(std::move(mesh));
         }
     }
     return meshes;
-}
\ No newline at end of file
+}
@@ -9,51 +9,10 @@
 #include "tinygltf/tiny_gltf.h"
 
 #include "geometry/mesh.h"
+#include "shading/texture_loader.h"
 
-std::vector<Mesh> load_gltf(std::string filepath);
-
-//utility classes for reading gltf buffers
-class IntArrayAdapterBase {
-    public:
-        virtual unsigned int get(size_t index) = 0;
-};
-
-template<typename T>
-class IntArrayAdapter: public IntArrayAdapterBase {
-    public:
-        const unsigned char* data_address;
-        const size_t byte_stride;
-        const size_t count;
-        IntArrayAdapter(const unsigned char* data_address, const size_t byte_stride,  const size_t count): data_address(data_address), byte_stride(byte_stride), count(count){};
-        unsigned int get(size_t index) {
-            T value =  *(reinterpret_cast<const T*>(this->data_address + index * this->byte_stride));
-            return static_cast<unsigned int>(value);
-        };
-};
-
-class Vec2ArrayAdapter{
-    public:
-        const unsigned char* data_address;
-        const size_t byte_stride;
-        const size_t count;
-        Vec2ArrayAdapter(const unsigned char* data_address, const size_t byte_stride,  const size_t count): data_address(data_address), byte_stride(byte_stride), count(count){};
-        glm::vec2 get(size_t index) {
-            glm::vec2 value =  *(reinterpret_cast<const glm::vec2*>(this->data_address + index * this->byte_stride));
-            return value;
-        };
-};
-
-
-class Vec3ArrayAdapter{
-    public:
-        const unsigned char* data_address;
-        const size_t byte_stride;
-        const size_t count;
-        Vec3ArrayAdapter(const unsigned char* data_address, const size_t byte_stride,  const size_t count): data_address(data_address), byte_stride(byte_stride), count(count){};
-        glm::vec3 get(size_t index) {
-            glm::vec3 value =  *(reinterpret_cast<const glm::vec3*>(this->data_address + index * this->byte_stride));
-            return value;
-        };
-};
+//meshes of a .gltf or binary .glb file, their textures are queued on textures.
+//Without a loader only the geometry is read, images are skipped undecoded
+std::vector<Mesh> load_gltf(std::string filepath, TextureLoader* textures);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,182 @@
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+
+#include "glm/gtc/packing.hpp"
+
+#include "assets/mesh_file.h"
+#include "util/mapped_file.h"
+#include "util/thread_pool.h"
+#include "util/math.h"
+
+static const char mesh_file_magic[4] = {'R', 'T', 'M', 'S'};
+static const uint32_t mesh_file_version = 1;
+static const uint32_t mesh_file_quantized = 1;
+static const size_t mesh_file_alignment = 64;
+
+enum MeshFileArray { Positions, Normals, TexCoords, Tangents, Bitangents, Indices, ArrayCount };
+
+struct MeshFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t vertex_count;
+    uint64_t index_count;
+    //byte offset and size of each array
+    uint64_t arrays[ArrayCount][2];
+    uint8_t padding[8];
+};
+static_assert(sizeof(MeshFileHeader) == 128, "mesh file header must stay 128 bytes");
+
+static size_t element_size(int array, bool quantized){
+    switch (array){
+        case Positions: return sizeof(glm::vec3);
+        case Indices: return sizeof(uint32_t);
+        case TexCoords: return quantized ? sizeof(uint32_t) : sizeof(glm::vec2);
+        default: return quantized ? sizeof(uint32_t) : sizeof(glm::vec3);
+    }
+}
+
+//array to write, shorter attribute arrays are padded with zeros
+template <typename T>
+static std::vector<T> padded(const std::vector<T>& values, size_t count){
+    std::vector<T> out(values.begin(), values.begin() + std::min(values.size(), count));
+    out.resize(count, T(0));
+    return out;
+}
+
+static std::vector<uint32_t> quantize_directions(const std::vector<glm::vec3>& directions){
+    std::vector<uint32_t> out(directions.size());
+    ThreadPool::global().parallel_for(0, directions.size(), 4096, [&](int begin, int end){
+        for (int i = begin; i < end; i++){
+            out[i] = glm::packSnorm2x16(oct_encode(directions[i]));
+        }
+    });
+    return out;
+}
+
+static void decode_directions(const uint32_t* in, std::vector<glm::vec3>& out){
+    ThreadPool::global().parallel_for(0, out.size(), 4096, [&](int begin, int end){
+        for (int i = begin; i < end; i++){
+            out[i] = oct_decode(glm::unpackSnorm2x16(in[i]));
+        }
+    });
+}
+
+bool save_mesh_file(const std::string& path, const Mesh& mesh, bool quantize){
+    size_t n = mesh.vertices.size();
+    std::vector<glm::vec3> normals = padded(mesh.normals, n);
+    std::vector<glm::vec2> tex_coords = padded(mesh.tex_coords, n);
+    std::vector<glm::vec3> tangents = padded(mesh.tangents, n);
+    std::vector<glm::vec3> bitangents = padded(mesh.bitangents, n);
+
+    std::vector<uint32_t> packed[ArrayCount];
+    const void* data[ArrayCount] = {mesh.vertices.data(), normals.data(), tex_coords.data(), tangents.data(), bitangents.data(), mesh.face_indices.data()};
+    if (quantize){
+        packed[Normals] = quantize_directions(normals);
+        packed[Tangents] = quantize_directions(tangents);
+        packed[Bitangents] = quantize_directions(bitangents);
+        packed[TexCoords].resize(n);
+        for (size_t i = 0; i < n; i++){
+            packed[TexCoords][i] = glm::packHalf2x16(tex_coords[i]);
+        }
+        for (int a : {Normals, TexCoords, Tangents, Bitangents}){
+            data[a] = packed[a].data();
+        }
+    }
+
+    MeshFileHeader header = {};
+    std::memcpy(header.magic, mesh_file_magic, 4);
+    header.version = mesh_file_version;
+    header.flags = quantize ? mesh_file_quantized : 0;
+    header.vertex_count = n;
+    header.index_count = mesh.face_indices.size();
+    uint64_t offset = sizeof(MeshFileHeader);
+    for (int a = 0; a < ArrayCount; a++){
+        offset = (offset + mesh_file_alignment - 1) / mesh_file_alignment * mesh_file_alignment;
+        header.arrays[a][0] = offset;
+        header.arrays[a][1] = (a == Indices ? header.index_count : n) * element_size(a, quantize);
+        offset += header.arrays[a][1];
+    }
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary);
+    if (!file){
+        return false;
+    }
+    file.write((const char*) &header, sizeof(header));
+    static const char zeros[mesh_file_alignment] = {};
+    uint64_t position = sizeof(header);
+    for (int a = 0; a < ArrayCount; a++){
+        file.write(zeros, header.arrays[a][0] - position);
+        file.write((const char*) data[a], header.arrays[a][1]);
+        position = header.arrays[a][0] + header.arrays[a][1];
+    }
+    file.close();
+    if (!file){
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+bool load_mesh_file(const std::string& path, Mesh& mesh){
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(MeshFileHeader)){
+        return false;
+    }
+    MeshFileHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, mesh_file_magic, 4) != 0 || header.version < 1 || header.version > mesh_file_version || header.index_count % 3 != 0){
+        return false;
+    }
+    bool quantized = header.flags & mesh_file_quantized;
+    for (int a = 0; a < ArrayCount; a++){
+        uint64_t count = a == Indices ? header.index_count : header.vertex_count;
+        uint64_t offset = header.arrays[a][0], bytes = header.arrays[a][1];
+        //counts are bounded by the file size first so a corrupt one can't overflow the product
+        uint64_t element = element_size(a, quantized);
+        if (count > file.size() / element || bytes != count * element || offset % 4 != 0 || offset > file.size() || bytes > file.size() - offset){
+            return false;
+        }
+    }
+    auto array = [&](int a){
+        return file.data() + header.arrays[a][0];
+    };
+
+    //triangles index the vertex arrays unchecked. Checked in the mapping, so
+    //mesh is only written once nothing can fail
+    size_t n = header.vertex_count;
+    const uint32_t* indices = (const uint32_t*) array(Indices);
+    for (uint64_t i = 0; i < header.index_count; i++){
+        if (indices[i] >= n){
+            return false;
+        }
+    }
+
+    mesh.vertices.resize(n);
+    mesh.normals.resize(n);
+    mesh.tex_coords.resize(n);
+    mesh.tangents.resize(n);
+    mesh.bitangents.resize(n);
+    mesh.face_indices.resize(header.index_count);
+    std::memcpy(mesh.vertices.data(), array(Positions), header.arrays[Positions][1]);
+    std::memcpy(mesh.face_indices.data(), indices, header.arrays[Indices][1]);
+    if (!quantized){
+        std::memcpy(mesh.normals.data(), array(Normals), header.arrays[Normals][1]);
+        std::memcpy(mesh.tex_coords.data(), array(TexCoords), header.arrays[TexCoords][1]);
+        std::memcpy(mesh.tangents.data(), array(Tangents), header.arrays[Tangents][1]);
+        std::memcpy(mesh.bitangents.data(), array(Bitangents), header.arrays[Bitangents][1]);
+        return true;
+    }
+
+    decode_directions((const uint32_t*) array(Normals), mesh.normals);
+    decode_directions((const uint32_t*) array(Tangents), mesh.tangents);
+    decode_directions((const uint32_t*) array(Bitangents), mesh.bitangents);
+    const uint32_t* uvs = (const uint32_t*) array(TexCoords);
+    for (size_t i = 0; i < n; i++){
+        mesh.tex_coords[i] = glm::unpackHalf2x16(uvs[i]);
+    }
+    return true;
+}
@@ -0,0 +1,21 @@
+#ifndef MESH_FILE_H_
+#define MESH_FILE_H_
+
+#include <string>
+
+#include "geometry/mesh.h"
+
+/*
+Native binary mesh file (.rtmesh), written by "raytracer-cpp convert" so
+scenes skip OBJ/glTF parsing, vertex de-duplication and tangent generation.
+A fixed header is followed by the position, normal, uv, tangent, bitangent
+and index arrays, each 64 byte aligned so the memory mapped file is copied
+into the mesh a whole array at a time. Quantized files store normals,
+tangents and bitangents octahedral encoded in two 16 bit snorms and uvs as
+half floats.
+*/
+bool save_mesh_file(const std::string& path, const Mesh& mesh, bool quantize);
+//false if the file is missing or invalid, mesh is left untouched then
+bool load_mesh_file(const std::string& path, Mesh& mesh);
+
+#endif
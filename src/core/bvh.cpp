@@ -59,6 +59,94 @@ void BVH::nearestIntersectionRecursive(Ray& ray, IntersectionData* nearest, BVHN
 };
 
 
+BVHNode* BVH::clone_nodes(const BVHNode* node){
+    if (node == nullptr){
+        return nullptr;
+    }
+    BVHNode* copy = new BVHNode(*node);
+    copy->left = this->clone_nodes(node->left);
+    copy->right = this->clone_nodes(node->right);
+    return copy;
+}
+
+//shifts the triangle ranges of a subtree, for moving it into a larger triangle array
+void BVH::offset_nodes(BVHNode* node, int offset){
+    if (node == nullptr){
+        return;
+    }
+    node->offset += offset;
+    this->offset_nodes(node->left, offset);
+    this->offset_nodes(node->right, offset);
+}
+
+/*
+Builds a tree whose leaves are the roots of already built subtrees, one per
+scene object, indexing into the same triangle array. Traversal doesn't know
+the difference, the roots are regular inner nodes (or leaves) of the tree.
+Takes ownership of the roots.
+*/
+BVHNode* BVH::build_top_level(std::vector<BVHNode*> roots){
+    if (roots.empty()){
+        return nullptr;
+    }
+    return this->build_top_level_recursive(roots.data(), roots.data() + roots.size());
+}
+
+BVHNode* BVH::build_top_level_recursive(BVHNode** begin, BVHNode** end){
+    int n = end - begin;
+    if (n == 1){
+        return *begin;
+    }
+
+    //sort the subtrees by centroid along the widest axis and sweep for the cheapest split
+    BBox bbox = (*begin)->bbox;
+    BBox centroids;
+    centroids.min = centroids.max = (*begin)->bbox.centroid();
+    int n_triangles = 0;
+    for (BVHNode** it = begin; it != end; it++){
+        bbox = BBox::unionBBox(bbox, (*it)->bbox);
+        glm::vec3 c = (*it)->bbox.centroid();
+        centroids.min = glm::min(centroids.min, c);
+        centroids.max = glm::max(centroids.max, c);
+        n_triangles += (*it)->n;
+    }
+    glm::vec3 extent = centroids.max - centroids.min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    std::sort(begin, end, [axis](BVHNode* a, BVHNode* b){
+        return a->bbox.centroid()[axis] < b->bbox.centroid()[axis];
+    });
+
+    std::vector<float> right_cost(n);
+    BBox right_bbox = begin[n - 1]->bbox;
+    int right_n = 0;
+    for (int i = n - 1; i > 0; i--){
+        right_bbox = BBox::unionBBox(right_bbox, begin[i]->bbox);
+        right_n += begin[i]->n;
+        right_cost[i] = right_bbox.surface_area() * right_n;
+    }
+    float min_cost = std::numeric_limits<float>::infinity();
+    int split = n / 2;
+    BBox left_bbox = begin[0]->bbox;
+    int left_n = 0;
+    for (int i = 1; i < n; i++){
+        left_bbox = BBox::unionBBox(left_bbox, begin[i - 1]->bbox);
+        left_n += begin[i - 1]->n;
+        float cost = left_bbox.surface_area() * left_n + right_cost[i];
+        if (cost < min_cost){
+            min_cost = cost;
+            split = i;
+        }
+    }
+
+    BVHNode* node = new BVHNode();
+    node->bbox = bbox;
+    node->offset = 0;
+    node->n = n_triangles;
+    node->left = this->build_top_level_recursive(begin, begin + split);
+    node->right = this->build_top_level_recursive(begin + split, end);
+    return node;
+}
+
 void BVH::build(){
     this->root = new BVHNode();
     this->root->bbox = (*this->triangles)[0].bbox();
@@ -76,25 +164,51 @@ void BVH::buildRecursive(BVHNode* parent){
         return;
     }
 
-   for (int i = 0; i < 3; i++){
-        this->bins[i] = std::vector<Bin>(this->n_bins, Bin());
-        this->splits[i] = std::vector<Split>(this->n_bins - 1, Split());
+    //per call so subtrees can be built concurrently
+    std::vector<Bin> bins[3];
+    std::vector<Split> splits[3];
+    for (int i = 0; i < 3; i++){
+        bins[i] = std::vector<Bin>(this->n_bins, Bin());
+        splits[i] = std::vector<Split>(this->n_bins - 1, Split());
     }
 
     glm::vec3 bbox_side_lengths = parent->bbox.max - parent->bbox.min;
 
     //bin triangles by centroid
-    for (int idx = parent->offset; idx < parent->offset + parent->n; idx++){
-        Triangle t = (*this->triangles)[idx];
-        glm::vec3 centroid = t.centroid();
-        for (int axis = 0; axis < 3; axis++){
-            float i = (centroid[axis] - parent->bbox.min[axis])/bbox_side_lengths[axis];
-            i = std::max(0.f, std::min(i, .999f));
-            int bin_num = (int) floor(this->n_bins * i);
-            Bin& bin = this->bins[axis][bin_num];
-            bin.n += 1;
-            bin.bbox = BBox::unionBBox(t.bbox(), bin.bbox);
+    auto bin_triangles = [this, parent, &bbox_side_lengths](int begin, int end, std::vector<Bin>* bins){
+        for (int idx = begin; idx < end; idx++){
+            Triangle t = (*this->triangles)[idx];
+            glm::vec3 centroid = t.centroid();
+            for (int axis = 0; axis < 3; axis++){
+                float i = (centroid[axis] - parent->bbox.min[axis])/bbox_side_lengths[axis];
+                i = std::max(0.f, std::min(i, .999f));
+                int bin_num = (int) floor(this->n_bins * i);
+                Bin& bin = bins[axis][bin_num];
+                bin.n += 1;
+                bin.bbox = BBox::unionBBox(t.bbox(), bin.bbox);
+            }
         }
+    };
+
+    if (parent->n > this->parallel_threshold){
+        std::mutex bins_mutex;
+        ThreadPool::global().parallel_for(parent->offset, parent->offset + parent->n, this->parallel_threshold, [&](int begin, int end){
+            std::vector<Bin> local[3];
+            for (int i = 0; i < 3; i++){
+                local[i] = std::vector<Bin>(this->n_bins, Bin());
+            }
+            bin_triangles(begin, end, local);
+
+            std::lock_guard<std::mutex> guard(bins_mutex);
+            for (int axis = 0; axis < 3; axis++){
+                for (int i = 0; i < this->n_bins; i++){
+                    bins[axis][i].n += local[axis][i].n;
+                    bins[axis][i].bbox = BBox::unionBBox(bins[axis][i].bbox, local[axis][i].bbox);
+                }
+            }
+        });
+    } else {
+        bin_triangles(parent->offset, parent->offset + parent->n, bins);
     }
 
     //calculate splits
@@ -106,8 +220,8 @@ void BVH::buildRecursive(BVHNode* parent){
         int right_n = 0;
 
         for (int i = 0; i < this->n_bins-1; i++){
-            Bin& bin = this->bins[axis][i];
-            Split& split = this->splits[axis][i];
+            Bin& bin = bins[axis][i];
+            Split& split = splits[axis][i];
             left_bbox = BBox::unionBBox(left_bbox, bin.bbox);
             left_n += bin.n;
             split.left_bbox = left_bbox;
@@ -115,8 +229,8 @@ void BVH::buildRecursive(BVHNode* parent){
         }
 
         for (int i = this->n_bins-2; i >= 0; i--){
-            Bin& bin = this->bins[axis][i + 1];
-            Split& split = this->splits[axis][i];
+            Bin& bin = bins[axis][i + 1];
+            Split& split = splits[axis][i];
             right_bbox = BBox::unionBBox(right_bbox, bin.bbox);
             right_n += bin.n;
             split.right_bbox = right_bbox;
@@ -134,7 +248,7 @@ void BVH::buildRecursive(BVHNode* parent){
     for (int axis = 0; axis < 3; axis++){
         for (int i = 0; i < this->n_bins - 1; i++){
 
-            Split& split = this->splits[axis][i];
+            Split& split = splits[axis][i];
 
             float p_right = split.right_bbox.surface_area()/parent->bbox.surface_area();
             float p_left = split.left_bbox.surface_area()/parent->bbox.surface_area();
@@ -178,7 +292,14 @@ void BVH::buildRecursive(BVHNode* parent){
 
     
 
-    this->buildRecursive(left);
-    this->buildRecursive(right);
+    if (parent->n > this->parallel_threshold){
+        TaskGroup group(ThreadPool::global());
+        group.run([this, left](){ this->buildRecursive(left); });
+        this->buildRecursive(right);
+        group.wait();
+    } else {
+        this->buildRecursive(left);
+        this->buildRecursive(right);
+    }
     
 };
\ No newline at end of file
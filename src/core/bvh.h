@@ -7,6 +7,7 @@
 #include <cmath>
 
 #include "geometry/geometry.h"
+#include "util/thread_pool.h"
 
 struct BVHNode {
     BBox bbox;
@@ -35,16 +36,12 @@ class BVH {
         std::vector<Triangle>* triangles = nullptr;
         BVHNode* root = nullptr;
         int n_bins = 128;
-        std::vector<Bin> bins[3];
-        std::vector<Split> splits[3];
+        //nodes with more triangles build their children as parallel tasks
+        int parallel_threshold = 16384;
 
         BVH(){}
         BVH(std::vector<Triangle>* triangles){
             this->triangles = triangles;
-            for (int i = 0; i < 3; i++){
-                this->bins[i] = std::vector<Bin>(this->n_bins, Bin());
-                this->splits[i] = std::vector<Split>(this->n_bins - 1, Split());
-            }
         }
 
         ~BVH(){
@@ -60,8 +57,16 @@ class BVH {
             delete parent;
         }
 
+        size_t count_nodes(const BVHNode* node) const {
+            return node == nullptr ? 0 : 1 + this->count_nodes(node->left) + this->count_nodes(node->right);
+        }
+
+        BVHNode* clone_nodes(const BVHNode* node);
+        void offset_nodes(BVHNode* node, int offset);
         void build();
         void buildRecursive(BVHNode* parent);
+        BVHNode* build_top_level(std::vector<BVHNode*> roots);
+        BVHNode* build_top_level_recursive(BVHNode** begin, BVHNode** end);
         IntersectionData nearestIntersection(Ray& ray);
         void nearestIntersectionRecursive(Ray& ray, IntersectionData* nearest, BVHNode* node, int depth);
         bool isOccluded(Ray& ray, float dist);
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <cmath>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp> 
@@ -36,8 +37,11 @@ class Camera {
         glm::vec3 position;
         Camera(){}
         Camera(float fov, float aspect_ratio, glm::mat4 transform);
-        Ray generateRay(float u, float v);
+        Ray generateRay(float u, float v) const;
+        //with differentials towards (u + du, v) and (u, v + dv)
+        Ray generateRay(float u, float v, float du, float dv) const;
         static Camera from_json(json config);
+        static std::vector<Camera> path_from_json(json config);
 };
 
 inline Camera::Camera(float fov, float aspect_ratio, glm::mat4 transform){
@@ -48,12 +52,22 @@ inline Camera::Camera(float fov, float aspect_ratio, glm::mat4 transform){
     this->position = this->transform * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
 }
 
-inline Ray Camera::generateRay(float u, float v){
+inline Ray Camera::generateRay(float u, float v) const {
     glm::vec3 dir = this->transform * glm::vec4(u * this->h * this->aspect_ratio, v * h, -1.f, 0);
     dir = glm::normalize(dir);
     return Ray(this->position, dir);
 }
 
+inline Ray Camera::generateRay(float u, float v, float du, float dv) const {
+    Ray ray = this->generateRay(u, v);
+    ray.has_differentials = true;
+    ray.rx_origin = this->position;
+    ray.ry_origin = this->position;
+    ray.rx_direction = this->generateRay(u + du, v).direction;
+    ray.ry_direction = this->generateRay(u, v + dv).direction;
+    return ray;
+}
+
 inline Camera Camera::from_json(json config){
     float fov = config["fov"];
     glm::vec3 pos = vector_to_vec3(config["position"]);
@@ -62,5 +76,54 @@ inline Camera Camera::from_json(json config){
     return Camera(fov, 1.0f, transform);
 }
 
+/*
+Cameras for batch rendering, either a list of cameras or
+{"frames": N, "keys": [camera, ...]} interpolating position, lookat and fov
+linearly between keys, or a turntable
+{"frames": N, "orbit": {"center": [x,y,z], "radius": r, "height": h, "fov": f}}
+*/
+inline std::vector<Camera> Camera::path_from_json(json config){
+    std::vector<Camera> cameras;
+    if (config.is_array()){
+        for (auto camera_config : config){
+            cameras.push_back(Camera::from_json(camera_config));
+        }
+        return cameras;
+    }
+
+    int frames = config["frames"];
+    for (int i = 0; i < frames; i++){
+        json camera_config;
+        if (config.contains("orbit")){
+            json orbit = config["orbit"];
+            glm::vec3 center = vector_to_vec3(orbit["center"]);
+            float radius = orbit["radius"];
+            float angle = 2.f * PI * i / frames;
+            glm::vec3 position = center + glm::vec3(radius * std::sin(angle), orbit.value("height", 0.f), radius * std::cos(angle));
+            camera_config["fov"] = orbit["fov"];
+            camera_config["position"] = {position.x, position.y, position.z};
+            camera_config["lookat"] = orbit["center"];
+        } else {
+            json keys = config["keys"];
+            float t = frames > 1 ? (float) i / (frames - 1) * (keys.size() - 1) : 0.f;
+            int key = std::min((int) t, (int) keys.size() - 2);
+            if (keys.size() == 1){
+                camera_config = keys[0];
+            } else {
+                float f = t - key;
+                json a = keys[key];
+                json b = keys[key + 1];
+                glm::vec3 position = glm::mix(vector_to_vec3(a["position"]), vector_to_vec3(b["position"]), f);
+                glm::vec3 lookat = glm::mix(vector_to_vec3(a["lookat"]), vector_to_vec3(b["lookat"]), f);
+                camera_config["fov"] = glm::mix(a["fov"].get<float>(), b["fov"].get<float>(), f);
+                camera_config["position"] = {position.x, position.y, position.z};
+                camera_config["lookat"] = {lookat.x, lookat.y, lookat.z};
+            }
+        }
+        cameras.push_back(Camera::from_json(camera_config));
+    }
+    return cameras;
+}
+
 #endif
 
@@ -0,0 +1,100 @@
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+
+#include "core/checkpoint.h"
+
+static const char checkpoint_magic[4] = {'R', 'T', 'C', 'K'};
+static const uint32_t checkpoint_version = 1;
+
+template <typename T>
+static void write_value(std::ofstream& file, const T& value){
+    file.write((const char*) &value, sizeof(T));
+}
+
+template <typename T>
+static bool read_value(std::ifstream& file, T& value){
+    return (bool) file.read((char*) &value, sizeof(T));
+}
+
+template <typename T>
+static void write_array(std::ofstream& file, const std::vector<T>& values){
+    file.write((const char*) values.data(), values.size() * sizeof(T));
+}
+
+template <typename T>
+static bool read_array(std::ifstream& file, std::vector<T>& values){
+    return (bool) file.read((char*) values.data(), values.size() * sizeof(T));
+}
+
+bool save_checkpoint(const std::string& path, const Film& film, int spp){
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary);
+    if (!file){
+        return false;
+    }
+
+    file.write(checkpoint_magic, 4);
+    write_value(file, checkpoint_version);
+    write_value(file, (int32_t) film.width);
+    write_value(file, (int32_t) film.height);
+    write_value(file, (int32_t) spp);
+    write_value(file, (uint8_t) film.has_aovs);
+
+    write_array(file, film.accumulator);
+    write_array(file, film.luminance_sq);
+    write_array(file, film.samples);
+    write_array(file, film.converged);
+    if (film.has_aovs){
+        write_array(file, film.albedo);
+        write_array(file, film.normal);
+        write_array(file, film.depth);
+    }
+    file.close();
+
+    if (!file){
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+bool load_checkpoint(const std::string& path, Film& film, int& spp){
+    std::ifstream file(path, std::ios::binary);
+    char magic[4];
+    uint32_t version = 0;
+    int32_t width, height, checkpoint_spp;
+    if (!file.read(magic, 4) || std::string(magic, 4) != std::string(checkpoint_magic, 4)){
+        return false;
+    }
+    if (!read_value(file, version) || version != checkpoint_version){
+        return false;
+    }
+    if (!read_value(file, width) || !read_value(file, height) || !read_value(file, checkpoint_spp)){
+        return false;
+    }
+    if (width <= 0 || height <= 0){
+        return false;
+    }
+
+    uint8_t has_aovs = 0;
+    if (!read_value(file, has_aovs)){
+        return false;
+    }
+
+    Film loaded(width, height);
+    if (!read_array(file, loaded.accumulator) || !read_array(file, loaded.luminance_sq) ||
+        !read_array(file, loaded.samples) || !read_array(file, loaded.converged)){
+        return false;
+    }
+    if (has_aovs){
+        loaded.enable_aovs();
+        if (!read_array(file, loaded.albedo) || !read_array(file, loaded.normal) || !read_array(file, loaded.depth)){
+            return false;
+        }
+    }
+
+    film = loaded;
+    spp = checkpoint_spp;
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <string>
+
+#include "core/film.h"
+
+/*
+Binary snapshot of a render in progress: film size, samples per pixel
+reached and for every pixel the radiance sum, squared luminance sum, sample
+count and converged flag, followed by the AOV sums when the film has them.
+Samples are seeded by pixel and sample index, so no generator state is kept.
+Files are written next to the target and renamed over it, so a render
+killed mid-write keeps the previous checkpoint. Partial renders of a
+distributed frame are saved in the same format and merged by sample count.
+*/
+bool save_checkpoint(const std::string& path, const Film& film, int spp);
+
+//replaces film with the checkpointed one, false if the file is missing or invalid
+bool load_checkpoint(const std::string& path, Film& film, int& spp);
+
+#endif
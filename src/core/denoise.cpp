@@ -0,0 +1,117 @@
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "core/denoise.h"
+#include "util/thread_pool.h"
+
+static const int denoise_tile_size = 32;
+
+//albedo radiance is divided by, misses and black surfaces are left as they are
+static glm::vec3 demodulation_albedo(const glm::vec3& albedo){
+    return glm::vec3(
+        albedo.x > 0.01f ? albedo.x : 1.f,
+        albedo.y > 0.01f ? albedo.y : 1.f,
+        albedo.z > 0.01f ? albedo.z : 1.f
+    );
+}
+
+void denoise_film(Film& film, const DenoiseSettings& settings){
+    if (!film.has_aovs){
+        return;
+    }
+    int width = film.width;
+    int height = film.height;
+    int n = width * height;
+
+    std::vector<glm::vec3> albedo(n), normal(n), color(n), filtered(n);
+    std::vector<float> depth(n), variance(n), filtered_variance(n);
+    for (int i = 0; i < n; i++){
+        albedo[i] = demodulation_albedo(film.mean_albedo(i));
+        normal[i] = film.mean_normal(i);
+        depth[i] = film.mean_depth(i);
+        color[i] = film.mean(i) / albedo[i];
+
+        //variance of the mean luminance, in demodulated units
+        int samples = film.samples[i];
+        if (samples > 0){
+            float mean = luminance(film.accumulator[i]) / samples;
+            float l = luminance(albedo[i]);
+            variance[i] = std::max(film.luminance_sq[i] / samples - mean * mean, 0.f) / samples / (l * l);
+        }
+    }
+
+    const float kernel[3] = {3.f / 8.f, 1.f / 4.f, 1.f / 16.f};
+    int tiles_x = (width + denoise_tile_size - 1) / denoise_tile_size;
+    int tiles_y = (height + denoise_tile_size - 1) / denoise_tile_size;
+
+    for (int iteration = 0; iteration < settings.iterations; iteration++){
+        int step = 1 << iteration;
+        ThreadPool::global().parallel_for(0, tiles_x * tiles_y, 1, [&](int begin, int end){
+            for (int t = begin; t < end; t++){
+                int x0 = (t % tiles_x) * denoise_tile_size;
+                int y0 = (t / tiles_x) * denoise_tile_size;
+                int x1 = std::min(x0 + denoise_tile_size, width);
+                int y1 = std::min(y0 + denoise_tile_size, height);
+                for (int y = y0; y < y1; y++){
+                    for (int x = x0; x < x1; x++){
+                        int p = y * width + x;
+                        if (film.samples[p] == 0){
+                            filtered[p] = color[p];
+                            filtered_variance[p] = variance[p];
+                            continue;
+                        }
+                        float l_p = luminance(color[p]);
+                        float sigma_l = settings.sigma_color * std::sqrt(variance[p]) + 1e-4f;
+
+                        glm::vec3 sum_color(0.f);
+                        float sum_variance = 0.f;
+                        float sum_weight = 0.f;
+                        for (int dy = -2; dy <= 2; dy++){
+                            int qy = y + dy * step;
+                            if (qy < 0 || qy >= height){
+                                continue;
+                            }
+                            for (int dx = -2; dx <= 2; dx++){
+                                int qx = x + dx * step;
+                                if (qx < 0 || qx >= width){
+                                    continue;
+                                }
+                                int q = qy * width + qx;
+                                if (film.samples[q] == 0){
+                                    continue;
+                                }
+
+                                float w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                                if (q != p){
+                                    float distance = step * std::sqrt((float) (dx * dx + dy * dy));
+                                    float w_normal = std::pow(std::max(glm::dot(normal[p], normal[q]), 0.f), settings.sigma_normal);
+                                    //both misses have zero normals
+                                    if (normal[p] == glm::vec3(0.f) && normal[q] == glm::vec3(0.f)){
+                                        w_normal = 1.f;
+                                    }
+                                    float z = std::max(depth[p], depth[q]);
+                                    float w_depth = z > 0.f ? std::exp(-std::abs(depth[p] - depth[q]) / (z * settings.sigma_depth * distance)) : 1.f;
+                                    float w_albedo = std::exp(-glm::length(albedo[p] - albedo[q]) / settings.sigma_albedo);
+                                    float w_color = std::exp(-std::abs(l_p - luminance(color[q])) / sigma_l);
+                                    w *= w_normal * w_depth * w_albedo * w_color;
+                                }
+                                sum_color += w * color[q];
+                                sum_variance += w * w * variance[q];
+                                sum_weight += w;
+                            }
+                        }
+                        filtered[p] = sum_color / sum_weight;
+                        filtered_variance[p] = sum_variance / (sum_weight * sum_weight);
+                    }
+                }
+            }
+        });
+        std::swap(color, filtered);
+        std::swap(variance, filtered_variance);
+    }
+
+    for (int i = 0; i < n; i++){
+        film.accumulator[i] = color[i] * albedo[i] * (float) film.samples[i];
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef DENOISE_H_
+#define DENOISE_H_
+
+#include "core/film.h"
+
+struct DenoiseSettings {
+    int iterations = 5;
+    //luminance edge stop in standard deviations of the pixel's noise
+    float sigma_color = 4.f;
+    //exponent of the normal similarity
+    float sigma_normal = 64.f;
+    //relative depth difference allowed per pixel of distance
+    float sigma_depth = 0.02f;
+    float sigma_albedo = 0.1f;
+};
+
+/*
+Edge avoiding a-trous wavelet filter guided by the first hit AOVs. Radiance
+is divided by albedo so texture detail is kept out of the blur, then filtered
+with a 5x5 B3 spline kernel of doubling step. Weights fall off with
+differences in normal, depth, albedo and luminance, the latter scaled by the
+per pixel noise estimate which is filtered along with the image. Each
+iteration runs over tiles on the thread pool.
+The film's radiance sums are replaced by the filtered image, sample counts
+stay, so mean() and everything downstream see the denoised frame. Needs a
+film with AOVs.
+*/
+void denoise_film(Film& film, const DenoiseSettings& settings = DenoiseSettings());
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef FILM_H_
+#define FILM_H_
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "glm/glm.hpp"
+
+#include "util/math.h"
+
+/*
+Per pixel sample accumulator. Next to the radiance sum it keeps the sample
+count and the sum of squared luminance, so pixels can receive different
+numbers of samples and their noise can be estimated while rendering.
+With AOVs enabled every sample also adds the albedo, shading normal and
+distance of its primary hit (0 on misses), averaged like the radiance.
+*/
+class Film {
+    public:
+        int width = 0;
+        int height = 0;
+        //image position of the film's first pixel, non zero for films covering a single tile
+        int x0 = 0;
+        int y0 = 0;
+        std::vector<glm::vec3> accumulator;
+        std::vector<float> luminance_sq;
+        std::vector<int> samples;
+        std::vector<unsigned char> converged;
+
+        bool has_aovs = false;
+        std::vector<glm::vec3> albedo;
+        std::vector<glm::vec3> normal;
+        std::vector<float> depth;
+
+        Film(){}
+        Film(int width, int height, int x0 = 0, int y0 = 0){
+            this->width = width;
+            this->height = height;
+            this->x0 = x0;
+            this->y0 = y0;
+            this->accumulator.assign(width * height, glm::vec3(0.f));
+            this->luminance_sq.assign(width * height, 0.f);
+            this->samples.assign(width * height, 0);
+            this->converged.assign(width * height, 0);
+        }
+
+        //index of image pixel (x, y)
+        int index(int x, int y) const {
+            return (y - this->y0) * this->width + (x - this->x0);
+        }
+
+        void enable_aovs(){
+            this->has_aovs = true;
+            this->albedo.assign(width * height, glm::vec3(0.f));
+            this->normal.assign(width * height, glm::vec3(0.f));
+            this->depth.assign(width * height, 0.f);
+        }
+
+        //called once per sample before add_sample
+        void add_aovs(int index, const glm::vec3& albedo, const glm::vec3& normal, float depth){
+            this->albedo[index] += albedo;
+            this->normal[index] += normal;
+            this->depth[index] += depth;
+        }
+
+        void add_sample(int index, const glm::vec3& radiance){
+            float l = luminance(radiance);
+            this->accumulator[index] += radiance;
+            this->luminance_sq[index] += l * l;
+            this->samples[index] += 1;
+        }
+
+        glm::vec3 mean(int index) const {
+            int n = this->samples[index];
+            return n > 0 ? this->accumulator[index] / (float) n : glm::vec3(0.f);
+        }
+
+        glm::vec3 mean_albedo(int index) const {
+            int n = this->samples[index];
+            return n > 0 ? this->albedo[index] / (float) n : glm::vec3(0.f);
+        }
+
+        glm::vec3 mean_normal(int index) const {
+            glm::vec3 n = this->normal[index];
+            float length = glm::length(n);
+            return length > 0.f ? n / length : glm::vec3(0.f);
+        }
+
+        float mean_depth(int index) const {
+            int n = this->samples[index];
+            return n > 0 ? this->depth[index] / n : 0.f;
+        }
+
+        //standard error of the mean luminance relative to the mean
+        float relative_error(int index) const {
+            int n = this->samples[index];
+            if (n < 2){
+                return std::numeric_limits<float>::infinity();
+            }
+            float mean = luminance(this->accumulator[index]) / n;
+            float variance = std::max(this->luminance_sq[index] / n - mean * mean, 0.f) * n / (n - 1);
+            return std::sqrt(variance / n) / (mean + 0.001f);
+        }
+
+        //average relative error over lit pixels with at least two samples
+        float mean_relative_error() const {
+            double total = 0.0;
+            int n = 0;
+            for (int i = 0; i < this->width * this->height; i++){
+                if (this->samples[i] >= 2 && luminance(this->accumulator[i]) > 0.f){
+                    total += this->relative_error(i);
+                    n += 1;
+                }
+            }
+            return n > 0 ? (float) (total / n) : std::numeric_limits<float>::infinity();
+        }
+
+        //adds the samples of a film of the same size, e.g. a partial render of the same frame
+        void merge(const Film& other){
+            for (int i = 0; i < this->width * this->height; i++){
+                this->accumulator[i] += other.accumulator[i];
+                this->luminance_sq[i] += other.luminance_sq[i];
+                this->samples[i] += other.samples[i];
+            }
+            if (other.has_aovs){
+                if (!this->has_aovs){
+                    this->enable_aovs();
+                }
+                for (int i = 0; i < this->width * this->height; i++){
+                    this->albedo[i] += other.albedo[i];
+                    this->normal[i] += other.normal[i];
+                    this->depth[i] += other.depth[i];
+                }
+            }
+        }
+
+        long long total_samples() const {
+            long long total = 0;
+            for (int n : this->samples){
+                total += n;
+            }
+            return total;
+        }
+};
+
+#endif
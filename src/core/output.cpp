@@ -0,0 +1,151 @@
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include "stb/stb_image_write.h"
+
+#include "core/output.h"
+#include "util/image_io.h"
+
+//radiance or one AOV, channels carry their full EXR names
+struct OutputLayer {
+    std::string name;
+    std::vector<ImageChannel> channels;
+};
+
+static bool has_extension(const std::string& path, const std::string& extension){
+    if (path.size() < extension.size()){
+        return false;
+    }
+    std::string end = path.substr(path.size() - extension.size());
+    std::transform(end.begin(), end.end(), end.begin(), ::tolower);
+    return end == extension;
+}
+
+static OutputLayer film_layer(const Film& film, const std::string& name, const std::vector<std::string>& channel_names, const std::function<void(int, float*)>& value){
+    int n = film.width * film.height;
+    OutputLayer layer = {name, {}};
+    for (const std::string& channel_name : channel_names){
+        layer.channels.push_back({channel_name, std::vector<float>(n)});
+    }
+    float values[3];
+    for (int i = 0; i < n; i++){
+        value(i, values);
+        for (size_t c = 0; c < channel_names.size(); c++){
+            layer.channels[c].data[i] = values[c];
+        }
+    }
+    return layer;
+}
+
+static std::vector<OutputLayer> film_layers(const Film& film, const std::vector<std::string>& aovs){
+    std::vector<OutputLayer> layers;
+    layers.push_back(film_layer(film, "", {"R", "G", "B"}, [&](int i, float* v){
+        glm::vec3 c = film.mean(i);
+        v[0] = c.x; v[1] = c.y; v[2] = c.z;
+    }));
+
+    for (const std::string& aov : aovs){
+        if (aov == "samples"){
+            layers.push_back(film_layer(film, aov, {"samples"}, [&](int i, float* v){ v[0] = film.samples[i]; }));
+        } else if (!film.has_aovs){
+            continue;
+        } else if (aov == "albedo"){
+            layers.push_back(film_layer(film, aov, {"albedo.R", "albedo.G", "albedo.B"}, [&](int i, float* v){
+                glm::vec3 c = film.mean_albedo(i);
+                v[0] = c.x; v[1] = c.y; v[2] = c.z;
+            }));
+        } else if (aov == "normal"){
+            layers.push_back(film_layer(film, aov, {"normal.X", "normal.Y", "normal.Z"}, [&](int i, float* v){
+                glm::vec3 c = film.mean_normal(i);
+                v[0] = c.x; v[1] = c.y; v[2] = c.z;
+            }));
+        } else if (aov == "depth"){
+            layers.push_back(film_layer(film, aov, {"Z"}, [&](int i, float* v){ v[0] = film.mean_depth(i); }));
+        }
+    }
+    return layers;
+}
+
+static ExrCompression exr_compression(const RenderConfig& config){
+    if (config.exr_compression == "none"){
+        return ExrCompression::None;
+    } else if (config.exr_compression == "zips"){
+        return ExrCompression::Zips;
+    }
+    return ExrCompression::Zip;
+}
+
+bool write_film(const std::string& path, const Film& film, const RenderConfig& config, const unsigned char* rgba){
+    if (has_extension(path, ".exr")){
+        std::vector<ImageChannel> channels;
+        for (OutputLayer& layer : film_layers(film, config.aovs)){
+            channels.insert(channels.end(), layer.channels.begin(), layer.channels.end());
+        }
+        return write_exr(path, film.width, film.height, channels, config.exr_half, exr_compression(config));
+    }
+
+    if (has_extension(path, ".pfm")){
+        //AOVs go to name.<aov>.pfm next to the image
+        std::string base = path.substr(0, path.size() - 4);
+        bool ok = true;
+        for (OutputLayer& layer : film_layers(film, config.aovs)){
+            std::vector<const ImageChannel*> channels;
+            for (const ImageChannel& channel : layer.channels){
+                channels.push_back(&channel);
+            }
+            std::string layer_path = layer.name.empty() ? path : base + "." + layer.name + ".pfm";
+            ok = write_pfm(layer_path, film.width, film.height, channels) && ok;
+        }
+        return ok;
+    }
+
+    if (!config.aovs.empty()){
+        std::cout << "AOVs need an .exr or .pfm output" << std::endl;
+    }
+    if (rgba != nullptr){
+        return stbi_write_png(path.c_str(), film.width, film.height, 4, rgba, film.width * 4) != 0;
+    }
+    std::vector<unsigned char> image(film.width * film.height * 4);
+    film_to_rgba8(film, config.tonemap, image.data());
+    return stbi_write_png(path.c_str(), film.width, film.height, 4, image.data(), film.width * 4) != 0;
+}
+
+bool writes_rgba8(const std::string& path){
+    return !has_extension(path, ".exr") && !has_extension(path, ".pfm");
+}
+
+bool ExrTileSink::open(const std::string& path, const RenderConfig& config){
+    this->aovs = config.aovs;
+
+    //channel names come from a one pixel film set up like the tiles
+    Film probe(1, 1);
+    if (config.needs_film_aovs()){
+        probe.enable_aovs();
+    }
+    std::vector<std::string> names;
+    for (OutputLayer& layer : film_layers(probe, this->aovs)){
+        for (ImageChannel& channel : layer.channels){
+            names.push_back(channel.name);
+        }
+    }
+    if (!this->writer.open(path, config.width, config.height, config.tile_size, names, config.exr_half, exr_compression(config))){
+        this->failed = true;
+    }
+    return !this->failed;
+}
+
+void ExrTileSink::write_tile(const RenderTile& tile, const Film& film){
+    std::vector<ImageChannel> channels;
+    for (OutputLayer& layer : film_layers(film, this->aovs)){
+        channels.insert(channels.end(), layer.channels.begin(), layer.channels.end());
+    }
+    if (!this->writer.write_tile(tile.x, tile.y, tile.w, tile.h, channels)){
+        this->failed = true;
+    }
+}
+
+bool ExrTileSink::close(){
+    bool closed = this->writer.close();
+    return closed && !this->failed;
+}
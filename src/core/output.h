@@ -0,0 +1,42 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "core/film.h"
+#include "core/render.h"
+#include "util/image_io.h"
+
+/*
+Writes the film in the format given by the path's extension. .exr and .pfm
+keep linear radiance and add the AOVs listed in config.aovs (albedo, normal,
+depth, samples) as extra EXR layers or as name.<aov>.pfm files next to the
+image, anything else is written as a tonemapped 8 bit PNG, taken from rgba
+when the tiles were already tonemapped while rendering.
+*/
+bool write_film(const std::string& path, const Film& film, const RenderConfig& config, const unsigned char* rgba = nullptr);
+
+//true if write_film stores path as a tonemapped 8 bit image
+bool writes_rgba8(const std::string& path);
+
+/*
+Streams finished tiles into a tiled EXR with the same channels write_film
+would produce, so a frame can be rendered without holding a full size film.
+Tiles must lie on the config.tile_size grid.
+*/
+class ExrTileSink : public TileSink {
+    public:
+        bool open(const std::string& path, const RenderConfig& config);
+        void write_tile(const RenderTile& tile, const Film& film) override;
+        //false if opening the file or any tile write failed
+        bool close();
+
+    private:
+        ExrTileWriter writer;
+        std::vector<std::string> aovs;
+        std::atomic<bool> failed{false};
+};
+
+#endif
@@ -0,0 +1,360 @@
+#include <iostream>
+#include <algorithm>
+
+#include "core/render.h"
+#include "util/progress_bar.h"
+#include "util/numa.h"
+#include "util/thread_pool.h"
+#include "core/checkpoint.h"
+
+std::vector<RenderTile> create_tiles(const RenderConfig& config, int spp){
+    std::vector<RenderTile> tiles;
+    int x0 = config.region_x0;
+    int y0 = config.region_y0;
+    int x1 = config.region_x1 > 0 ? std::min(config.region_x1, config.width) : config.width;
+    int y1 = config.region_y1 > 0 ? std::min(config.region_y1, config.height) : config.height;
+    int tile_index = 0;
+
+    for (int y = 0; y < config.height; y += config.tile_size){
+        for (int x = 0; x < config.width; x += config.tile_size){
+            RenderTile tile = {config.tile_size, config.tile_size, x, y, spp};
+            if (y + config.tile_size > config.height) { tile.h = config.height - y; }
+            if (x + config.tile_size > config.width)  { tile.w = config.width - x;  }
+
+            int index = tile_index++;
+            if (index < config.tile_begin || (config.tile_end > 0 && index >= config.tile_end)){
+                continue;
+            }
+            int tx0 = std::max(tile.x, x0);
+            int ty0 = std::max(tile.y, y0);
+            int tx1 = std::min(tile.x + tile.w, x1);
+            int ty1 = std::min(tile.y + tile.h, y1);
+            if (tx0 >= tx1 || ty0 >= ty1){
+                continue;
+            }
+            tile = {tx1 - tx0, ty1 - ty0, tx0, ty0, spp};
+            tiles.push_back(tile);
+        }
+    }
+    order_tiles(tiles, config.tile_order, config.width, config.height, config.tile_size);
+    return tiles;
+}
+
+void render_tiled_worker(Integrator& integrator, Scene& scene, RenderConfig config, TileScheduler& scheduler, const std::vector<Frame>& frames, const std::function<void(const RenderTile&)>& tile_done, int thread){
+    RenderTile tile;
+    while(scheduler.next(tile, thread)){
+        const Frame& frame = frames[tile.frame];
+        if (frame.sink != nullptr){
+            Film film(tile.w, tile.h, tile.x, tile.y);
+            if (config.needs_film_aovs()){
+                film.enable_aovs();
+            }
+            integrator.render_tile(tile, scene, frame.camera, config, film);
+            frame.sink->write_tile(tile, film);
+        } else if (config.deadline <= 0.0 || currentTimeMilliseconds() <= config.deadline){
+            integrator.render_tile(tile, scene, frame.camera, config, *frame.film);
+            if (frame.rgba != nullptr){
+                tonemap_rect(*frame.film, config.tonemap, tile.x, tile.y, tile.w, tile.h, frame.rgba);
+            }
+        }
+        if (tile_done){
+            tile_done(tile);
+        }
+    }
+}
+
+/*
+Render workers run as tasks on the global thread pool, one per
+config.num_threads. Tiles may belong to different frames; frame_done is
+called from the worker that finishes the last tile of a frame.
+*/
+void render_pass(Integrator& integrator, const std::vector<Scene*>& scenes, const RenderConfig& config, const std::vector<RenderTile>& tiles, const std::vector<Frame>& frames, const std::function<void(int)>& frame_done){
+
+    std::vector<std::vector<RenderTile>> runs;
+
+    //streamed tiles have to stay on the output file's tile grid
+    bool split = frames[0].sink == nullptr;
+
+    if (config.tile_runs && config.num_threads > 1){
+        int n = config.num_threads;
+        for (int i = 0; i < n; i++){
+            std::vector<RenderTile> run(tiles.begin() + tiles.size() * i / n, tiles.begin() + tiles.size() * (i + 1) / n);
+            runs.push_back(split ? split_tail(run, 2, 4) : run);
+        }
+    } else {
+        runs.push_back(split ? split_tail(tiles, config.num_threads, 4) : tiles);
+    }
+    TileScheduler scheduler(runs);
+
+    NumaTopology topology;
+    if (config.numa){
+        topology = NumaTopology::detect();
+    }
+
+    std::unique_ptr<std::atomic<int>[]> remaining(new std::atomic<int>[frames.size()]);
+    for (size_t f = 0; f < frames.size(); f++){
+        remaining[f] = 0;
+    }
+    for (const std::vector<RenderTile>& run : runs){
+        for (const RenderTile& tile : run){
+            remaining[tile.frame] += 1;
+        }
+    }
+    std::function<void(const RenderTile&)> tile_done;
+    if (frame_done){
+        tile_done = [&](const RenderTile& tile){
+            if (remaining[tile.frame].fetch_sub(1) == 1){
+                frame_done(tile.frame);
+            }
+        };
+    }
+
+    TaskGroup group(ThreadPool::global());
+    for (int i = 0; i < config.num_threads; i++) {
+        Scene* scene = scenes[(long long) i * scenes.size() / config.num_threads];
+        group.run([&, scene, i](){
+            //pool threads go back to running anywhere after the pass
+            std::unique_ptr<ScopedThreadPin> pin;
+            if (config.numa){
+                pin.reset(new ScopedThreadPin(topology.nodes[topology.node_of_thread(i, config.num_threads)]));
+            }
+            render_tiled_worker(integrator, *scene, config, scheduler, frames, tile_done, i);
+        });
+    }
+    group.wait();
+}
+
+/*
+With config.numa every NUMA node gets its own copy of the scene geometry and
+BVH, made by a thread pinned to that node so first touch places the pages
+there, and render threads are pinned to the node whose copy they read.
+Returns the scenes render passes spread their threads over.
+*/
+std::vector<Scene*> replicate_scene(Scene& scene, const RenderConfig& config, std::vector<std::unique_ptr<Scene>>& replicas){
+    std::vector<Scene*> scenes = {&scene};
+
+    if (config.numa){
+        NumaTopology topology = NumaTopology::detect();
+        if (topology.nodes.size() > 1){
+            scenes.clear();
+            for (const std::vector<int>& cpus : topology.nodes){
+                replicas.push_back(std::unique_ptr<Scene>(new Scene()));
+                Scene* replica = replicas.back().get();
+                std::thread([replica, &scene, &cpus](){
+                    pin_current_thread(cpus);
+                    replica->replicate(scene);
+                }).join();
+                scenes.push_back(replica);
+            }
+            std::cout << "replicated scene on " << scenes.size() << " numa nodes" << std::endl;
+        }
+    }
+    return scenes;
+}
+
+void render_tiled(Integrator& integrator, Scene& scene, RenderConfig config, Film& film, unsigned char* rgba){
+    integrator.prepare(scene, config);
+
+    std::vector<std::unique_ptr<Scene>> replicas;
+    std::vector<Scene*> scenes = replicate_scene(scene, config, replicas);
+    Frame frame = {scene.camera, &film, nullptr, rgba};
+
+    //passes revisit tiles, so the image is tonemapped once at the end
+    if (config.progressive || config.adaptive_threshold > 0.f || !config.checkpoint_file.empty()){
+        frame.rgba = nullptr;
+        render_progressive(integrator, scenes, config, frame);
+        if (rgba != nullptr){
+            film_to_rgba8(film, config.tonemap, rgba);
+        }
+        return;
+    }
+    render_pass(integrator, scenes, config, create_tiles(config, config.spp), {frame});
+}
+
+/*
+Renders the frame tile by tile into films covering one tile each and passes
+them to the sink as they finish, so memory is bounded by the tiles in flight.
+Every tile gets all config.spp samples, there are no progressive passes.
+*/
+void render_streamed(Integrator& integrator, Scene& scene, RenderConfig config, TileSink& sink){
+    integrator.prepare(scene, config);
+
+    std::vector<std::unique_ptr<Scene>> replicas;
+    std::vector<Scene*> scenes = replicate_scene(scene, config, replicas);
+    Frame frame;
+    frame.camera = scene.camera;
+    frame.sink = &sink;
+    render_pass(integrator, scenes, config, create_tiles(config, config.spp), {frame});
+}
+
+/*
+Renders one frame per camera reusing the scene and thread pool, films are
+allocated per frame and released after frame_done. With config.interleave
+the tiles of all frames go into one scheduler so threads move on to the
+next frame instead of idling through the tail of the current one. Progressive
+and adaptive rendering, and integrators keeping per pixel history, render
+the frames one after another.
+*/
+void render_batch(Integrator& integrator, Scene& scene, RenderConfig config, const std::vector<Camera>& cameras, const std::function<void(int, Film&)>& frame_done){
+    integrator.prepare(scene, config);
+
+    std::vector<std::unique_ptr<Scene>> replicas;
+    std::vector<Scene*> scenes = replicate_scene(scene, config, replicas);
+    //checkpoints hold a single film
+    config.checkpoint_file.clear();
+    config.resume_spp = 0;
+
+    std::vector<Frame> frames(cameras.size());
+    std::vector<std::unique_ptr<Film>> films(cameras.size());
+    for (size_t i = 0; i < cameras.size(); i++){
+        frames[i].camera = cameras[i];
+        frames[i].camera.aspect_ratio = float(config.width)/float(config.height);
+    }
+    auto finish = [&](int i){
+        frame_done(i, *films[i]);
+        films[i].reset();
+    };
+
+    bool passes = config.progressive || config.adaptive_threshold > 0.f;
+    if (!config.interleave || passes || integrator.has_pixel_history()){
+        for (size_t i = 0; i < frames.size(); i++){
+            films[i].reset(new Film(config.width, config.height));
+            if (config.needs_film_aovs()){
+                films[i]->enable_aovs();
+            }
+            frames[i].film = films[i].get();
+            config.frame_index = i;
+            if (passes){
+                render_progressive(integrator, scenes, config, frames[i]);
+            } else {
+                render_pass(integrator, scenes, config, create_tiles(config, config.spp), {frames[i]});
+            }
+            finish(i);
+        }
+        return;
+    }
+
+    std::vector<RenderTile> tiles;
+    for (size_t i = 0; i < frames.size(); i++){
+        films[i].reset(new Film(config.width, config.height));
+        if (config.needs_film_aovs()){
+            films[i]->enable_aovs();
+        }
+        frames[i].film = films[i].get();
+        for (RenderTile tile : create_tiles(config, config.spp)){
+            tile.frame = i;
+            tiles.push_back(tile);
+        }
+    }
+    render_pass(integrator, scenes, config, tiles, frames, finish);
+}
+
+/*
+Renders the whole frame in passes into the film. Progressive passes double
+the sample count each time so every pass ends on a uniformly sampled image;
+adaptive passes add min_spp samples and skip pixels whose relative error is
+below the threshold, dropping tiles without unconverged pixels. Stops at
+config.spp, the noise target or the time limit. Pass sizes are trimmed to
+fit the remaining time and tiles are not started past the deadline.
+Checkpointed renders that are neither progressive nor adaptive use passes
+sized to the checkpoint interval, the film is saved after a pass once the
+interval has passed and when rendering stops.
+*/
+void render_progressive(Integrator& integrator, const std::vector<Scene*>& scenes, RenderConfig config, const Frame& frame){
+    Film& film = *frame.film;
+    std::vector<RenderTile> tiles = create_tiles(config, 0);
+    double start = currentTimeMilliseconds();
+    if (config.time_limit > 0.0){
+        config.deadline = start + config.time_limit * 1000.0;
+    }
+    bool adaptive = config.adaptive_threshold > 0.f;
+    bool checkpoint = !config.checkpoint_file.empty();
+    double last_checkpoint = start;
+    int rendered = config.resume_spp;
+    int pass = 0;
+
+    while (rendered < config.spp && !tiles.empty()){
+        //samples per pixel traced by this run, resumed samples excluded
+        int traced = rendered - config.resume_spp;
+        double elapsed = currentTimeMilliseconds() - start;
+
+        int spp;
+        if (adaptive){
+            spp = config.min_spp;
+        } else if (config.progressive){
+            spp = std::max(rendered, 1);
+        } else {
+            spp = traced > 0 ? std::max(1, (int) (config.checkpoint_interval * 1000.0 / (elapsed / traced))) : 1;
+        }
+        spp = std::min(spp, config.spp - rendered);
+
+        if (config.time_limit > 0.0 && traced > 0){
+            double remaining = config.deadline - start - elapsed;
+            int affordable = (int) (remaining / (elapsed / traced));
+            if (affordable < 1){
+                break;
+            }
+            spp = std::min(spp, affordable);
+        }
+
+        for (RenderTile& tile : tiles){
+            tile.spp = spp;
+        }
+        render_pass(integrator, scenes, config, tiles, {frame});
+        pass += 1;
+
+        //tiles skipped after the deadline didn't get this pass, count what every pixel still sampled reached
+        int reached = rendered + spp;
+        for (const RenderTile& tile : tiles){
+            for (int y = tile.y; y < tile.y + tile.h; y++){
+                for (int x = tile.x; x < tile.x + tile.w; x++){
+                    int index = y * config.width + x;
+                    if (!film.converged[index]){
+                        reached = std::min(reached, (int) film.samples[index]);
+                    }
+                }
+            }
+        }
+        rendered = reached;
+
+        if (adaptive){
+            std::vector<RenderTile> remaining;
+            for (RenderTile& tile : tiles){
+                bool tile_converged = true;
+                for (int y = tile.y; y < tile.y + tile.h; y++){
+                    for (int x = tile.x; x < tile.x + tile.w; x++){
+                        int index = y * config.width + x;
+                        if (!film.converged[index] && film.relative_error(index) < config.adaptive_threshold){
+                            film.converged[index] = 1;
+                        }
+                        tile_converged = tile_converged && film.converged[index];
+                    }
+                }
+                if (!tile_converged){
+                    remaining.push_back(tile);
+                }
+            }
+            tiles = remaining;
+        }
+
+        if (config.progressive){
+            std::cout << "pass " << pass << ": " << rendered << "spp, " << (currentTimeMilliseconds() - start) / 1000.0 << "s" << std::endl;
+        }
+
+        if (checkpoint && currentTimeMilliseconds() - last_checkpoint >= config.checkpoint_interval * 1000.0){
+            save_checkpoint(config.checkpoint_file, film, rendered);
+            last_checkpoint = currentTimeMilliseconds();
+        }
+
+        if (config.noise_target > 0.f && film.mean_relative_error() <= config.noise_target){
+            break;
+        }
+        if (config.deadline > 0.0 && currentTimeMilliseconds() >= config.deadline){
+            break;
+        }
+    }
+
+    if (checkpoint){
+        save_checkpoint(config.checkpoint_file, film, rendered);
+    }
+}
@@ -4,10 +4,14 @@
 #include <string>
 #include <vector>
 #include <thread>
+#include <memory>
+#include <functional>
 
 #include "core/scene.h"
+#include "core/film.h"
+#include "core/tonemap.h"
+#include "core/tile_scheduler.h"
 #include "integrator/integrator.h"
-#include "util/thread_safe_queue.h"
 #include "util/math.h"
 
 
@@ -18,64 +22,105 @@ struct RenderConfig {
     int max_bounces;
     int num_threads;
     int tile_size;
+    //scanline, hilbert or spiral
+    std::string tile_order = "scanline";
+    //give every thread a contiguous run of tiles instead of sharing one list
+    bool tile_runs = false;
+    //pin threads to NUMA nodes and give every node its own copy of the scene
+    bool numa = false;
+    //batch rendering hands out the tiles of all frames from one scheduler
+    bool interleave = false;
     std::string output_file;
+    //extra layers for .exr/.pfm output: albedo, normal, depth, samples
+    std::vector<std::string> aovs;
+    bool exr_half = true;
+    //none, zips or zip
+    std::string exr_compression = "zip";
+    //display transform for 8 bit output
+    ToneMapping tonemap;
+    //run denoise_film on the finished frame, collects the AOVs it needs
+    bool denoise = false;
     std::string scene_file;
+    std::string integrator;
+
+    //adaptive sampling, disabled when threshold is 0. spp is the per pixel maximum
+    float adaptive_threshold = 0.f;
+    int min_spp = 16;
+
+    //progressive rendering, whole frame passes until spp, time_limit (seconds)
+    //or noise_target (mean relative error) is reached. 0 disables a criterion
+    bool progressive = false;
+    double time_limit = 0.0;
+    float noise_target = 0.f;
+    //tiles are no longer started after this time (currentTimeMilliseconds), 0 for none
+    double deadline = 0.0;
+
+    //film and sample counts are saved here every checkpoint_interval seconds
+    std::string checkpoint_file;
+    double checkpoint_interval = 300.0;
+    //samples per pixel already in the film when resuming from a checkpoint
+    int resume_spp = 0;
+
+    //partial renders for distributing a frame: only tiles overlapping the region
+    //[x0, x1) x [y0, y1) (clipped to it) and tiles [tile_begin, tile_end) of the
+    //scanline tile list are rendered, 0 ends mean unrestricted. Pixel samples are
+    //numbered from sample_offset so machines can render disjoint sample ranges
+    int region_x0 = 0, region_y0 = 0, region_x1 = 0, region_y1 = 0;
+    int tile_begin = 0, tile_end = 0;
+    int sample_offset = 0;
+    //frame of a batch render whose frames are rendered one at a time, added
+    //to RenderTile::frame when seeding so every frame gets its own noise
+    int frame_index = 0;
+
+    //albedo, normal and depth are accumulated in the film while rendering
+    bool needs_film_aovs() const {
+        if (this->denoise){
+            return true;
+        }
+        for (const std::string& aov : this->aovs){
+            if (aov != "samples"){
+                return true;
+            }
+        }
+        return false;
+    }
 };
 
-struct RenderTile {
-    int w, h, x, y;
+//receives finished tiles of a frame rendered without a full size film
+class TileSink {
+    public:
+        virtual ~TileSink(){}
+        //called concurrently from the render threads with a film covering just the tile
+        virtual void write_tile(const RenderTile& tile, const Film& film) = 0;
 };
 
-void render_tiled_worker(Integrator& integrator, Scene& scene, RenderConfig config, ThreadSafeQueue<RenderTile>& tile_queue, glm::vec3* accumulator){
-    RenderTile tile;
-    
-    while(tile_queue.pop(tile)){
-        
-         for (int y = tile.y; y < tile.y + tile.h; y++){
-            for (int x = tile.x; x < tile.x + tile.w; x++){
-                int index = y * config.width + x;
-                accumulator[index] = glm::vec3(0.f,0.f,0.f);
-
-                float u =  (float) x / (float) config.width  * 2 - 1;
-                float v = -((float) y / (float) config.height * 2 - 1);
+//camera and film (or tile sink) of one frame, tiles pick theirs with RenderTile::frame.
+//With rgba set every finished tile is also tonemapped into it right away
+struct Frame {
+    Camera camera;
+    Film* film = nullptr;
+    TileSink* sink = nullptr;
+    unsigned char* rgba = nullptr;
+};
 
-                for (int s = 0; s < config.spp; s++){
+//jittered primary ray through pixel (x,y)
+inline Ray generate_camera_ray(const Camera& camera, const RenderConfig& config, int x, int y){
+    float u =  (float) x / (float) config.width  * 2 - 1;
+    float v = -((float) y / (float) config.height * 2 - 1);
 
-                    float aa_x = randuf() / (float) config.width;
-                    float aa_y = randuf() / (float) config.height;
+    float aa_x = randuf() / (float) config.width;
+    float aa_y = randuf() / (float) config.height;
 
-                    Ray camera_ray = scene.camera.generateRay(u + aa_x,v + aa_y); 
-                    accumulator[index] += integrator.trace(camera_ray, scene);
-                }
-            }
-        }        
-    }
+    return camera.generateRay(u + aa_x, v + aa_y, 2.f / (float) config.width, -2.f / (float) config.height);
 }
 
+std::vector<RenderTile> create_tiles(const RenderConfig& config, int spp);
+void render_tiled_worker(Integrator& integrator, Scene& scene, RenderConfig config, TileScheduler& scheduler, const std::vector<Frame>& frames, const std::function<void(const RenderTile&)>& tile_done, int thread);
+void render_pass(Integrator& integrator, const std::vector<Scene*>& scenes, const RenderConfig& config, const std::vector<RenderTile>& tiles, const std::vector<Frame>& frames, const std::function<void(int)>& frame_done = nullptr);
+std::vector<Scene*> replicate_scene(Scene& scene, const RenderConfig& config, std::vector<std::unique_ptr<Scene>>& replicas);
+void render_tiled(Integrator& integrator, Scene& scene, RenderConfig config, Film& film, unsigned char* rgba = nullptr);
+void render_streamed(Integrator& integrator, Scene& scene, RenderConfig config, TileSink& sink);
+void render_batch(Integrator& integrator, Scene& scene, RenderConfig config, const std::vector<Camera>& cameras, const std::function<void(int, Film&)>& frame_done);
+void render_progressive(Integrator& integrator, const std::vector<Scene*>& scenes, RenderConfig config, const Frame& frame);
 
-void render_tiled(Integrator& integrator, Scene& scene, RenderConfig config, glm::vec3* accumulator){
-    
-    std::vector<std::thread> threads;
-    ThreadSafeQueue<RenderTile> tile_queue;
-
-    for (int i = 0; i < config.num_threads; i++) {
-        threads.push_back(std::thread(render_tiled_worker, std::ref(integrator), std::ref(scene), config, std::ref(tile_queue), accumulator));
-    }
-
-    //create tiles
-    for (int y = 0; y < config.height; y += config.tile_size){
-        for (int x = 0; x < config.width; x += config.tile_size){
-            RenderTile tile = {config.tile_size, config.tile_size, x, y};
-            if (y + config.tile_size > config.height) { tile.h = config.height - y; }
-            if (x + config.tile_size > config.width)  { tile.w = config.width - x;  }
-            tile_queue.push(tile);
-        }
-    }
-
-    tile_queue.close();
-    for (auto &t : threads) {
-        t.join();
-    }
-}
-
-#endif
\ No newline at end of file
+#endif
@@ -1,5 +1,7 @@
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <stdexcept>
 
 #define TINYGLTF_NO_INCLUDE_STB_IMAGE_WRITE 
 #define TINYGLTF_NO_INCLUDE_STB_IMAGE
@@ -10,19 +12,102 @@
 #include "core/scene.h"
 #include "shading/material.h"
 #include "shading/texture.h"
+#include "shading/texture_loader.h"
 #include "shading/materials/all.h"
 #include "assets/gtlf_loader.h"
+#include "assets/mesh_file.h"
+#include "util/thread_pool.h"
 
 void Scene::build(){
     std::cout << "building scene" << std::endl;
     this->triangles.clear();
-    for (Mesh& mesh: this->meshes){
-        this->addMesh(mesh);
-    } 
-    bvh = BVH(&this->triangles);
-    bvh.build();
+    if (this->objects){
+        this->merge_objects();
+    } else {
+        for (Mesh& mesh: this->meshes){
+            this->addMesh(mesh);
+        } 
+        bvh = BVH(&this->triangles);
+        bvh.build();
+    }
+
+    if (this->texture_loads){
+        this->texture_loads->wait();
+        std::cout << this->texture_loads->size() << " textures loaded" << std::endl;
+        this->texture_loads.reset();
+    }
+}
+
+/*
+Deep copies the meshes, triangles and BVH of a built scene so the copy is
+allocated by the calling thread, materials and textures stay shared. Used to
+give each NUMA node its own copy of the read only scene data.
+*/
+void Scene::replicate(const Scene& other){
+    this->camera = other.camera;
+    this->meshes = other.meshes;
+
+    auto remap = [this, &other](const Triangle& t){
+        return Triangle(&this->meshes[t.mesh - other.meshes.data()], t.face_offset);
+    };
+    this->triangles.clear();
+    this->triangles.reserve(other.triangles.size());
+    for (const Triangle& t : other.triangles){
+        this->triangles.push_back(remap(t));
+    }
+    this->lights.clear();
+    for (const Triangle& t : other.lights){
+        this->lights.push_back(remap(t));
+    }
+
+    this->bvh.free_nodes(this->bvh.root);
+    this->bvh.triangles = &this->triangles;
+    this->bvh.root = this->bvh.clone_nodes(other.bvh.root);
 }
 
+//approximate bytes held by the geometry, BVH and textures of a built scene
+size_t Scene::memory_usage() const {
+    size_t bytes = sizeof(Scene);
+    std::unordered_set<const Material*> materials;
+    for (const Mesh& mesh : this->meshes){
+        bytes += sizeof(Mesh) + mesh.memory_usage();
+        materials.insert(mesh.material);
+    }
+    bytes += (this->triangles.size() + this->lights.size()) * sizeof(Triangle);
+    bytes += this->bvh.count_nodes(this->bvh.root) * sizeof(BVHNode);
+
+    //materials can share textures
+    std::unordered_set<const TextureMap*> textures;
+    for (const Material* material : materials){
+        if (auto diffuse = dynamic_cast<const DiffuseMaterial*>(material)){
+            textures.insert(diffuse->albedo_texture.get());
+            textures.insert(diffuse->normal_texture.get());
+        } else if (auto reflection = dynamic_cast<const ReflectionMaterial*>(material)){
+            textures.insert(reflection->albedo_texture.get());
+            textures.insert(reflection->normal_texture.get());
+        }
+    }
+    for (const TextureMap* texture : textures){
+        bytes += texture == nullptr ? 0 : texture->memory_usage();
+    }
+    return bytes;
+}
+
+/*
+Deletes the materials (and their textures) referenced by the meshes. Scenes
+don't own their materials since replicas share them, so whoever loaded the
+scene calls this before dropping it.
+*/
+void Scene::release_materials(){
+    std::unordered_set<Material*> materials;
+    for (Mesh& mesh : this->meshes){
+        materials.insert(mesh.material);
+        mesh.material = nullptr;
+    }
+    for (Material* material : materials){
+        delete material;
+    }
+}
 
 LightSample Scene::sampleLight(IntersectionData& intersection){
     LightSample sample;
@@ -62,6 +147,56 @@ void Scene::addMesh(Mesh& mesh){
 
 
 
+/*
+Moves the meshes and triangles of the objects built by load_file into the
+scene. Each object's BVH was built over its own triangles while the other
+objects were still loading, here their triangle ranges are offset into the
+scene's array and their roots become the leaves of a small tree over the
+objects. Lights are listed in mesh order, as addMesh does.
+*/
+void Scene::merge_objects(){
+    std::vector<SceneObject>& objects = *this->objects;
+    size_t n_meshes = this->meshes.size();
+    size_t n_triangles = 0;
+    for (SceneObject& object : objects){
+        n_meshes += object.meshes.size();
+        n_triangles += object.triangles.size();
+    }
+    //no reallocation, triangles point into meshes
+    this->meshes.reserve(n_meshes);
+    this->triangles.reserve(n_triangles);
+
+    std::vector<BVHNode*> roots;
+    for (SceneObject& object : objects){
+        Mesh* base = this->meshes.data() + this->meshes.size();
+        int offset = this->triangles.size();
+        for (Mesh& mesh : object.meshes){
+            this->meshes.push_back(std::move(mesh));
+        }
+        for (const Triangle& t : object.triangles){
+            this->triangles.push_back(Triangle(base + (t.mesh - object.meshes.data()), t.face_offset));
+        }
+        if (object.root != nullptr){
+            this->bvh.offset_nodes(object.root, offset);
+            roots.push_back(object.root);
+        }
+    }
+    this->objects.reset();
+
+    for (Mesh& mesh : this->meshes){
+        if (mesh.is_light){
+            for (size_t i = 0; i < mesh.face_indices.size(); i+=3){
+                this->lights.push_back(Triangle(&mesh, (int) i));
+            }
+        }
+    }
+
+    this->bvh.free_nodes(this->bvh.root);
+    this->bvh.triangles = &this->triangles;
+    this->bvh.root = this->bvh.build_top_level(roots);
+    std::cout << roots.size() << " object BVHs merged" << std::endl;
+}
+
 Scene Scene::load_file(std::string filepath){
     std::cout << "loading scene" << std::endl;
 
@@ -76,6 +211,10 @@ Scene Scene::load_file(std::string filepath){
     json camera_config = config["camera"];
     scene.camera = Camera::from_json(camera_config);
 
+    //textures decode on the pool while meshes load, the same file is decoded once
+    scene.texture_loads = std::make_shared<TextureLoader>(ThreadPool::global());
+    TextureLoader& textures = *scene.texture_loads;
+
     
     std::unordered_map<std::string, Material*> material_map;
     for (auto mat_config: config["materials"]){
@@ -87,14 +226,14 @@ Scene Scene::load_file(std::string filepath){
             DiffuseMaterial* material = new DiffuseMaterial();
             if (mat_config.contains("albedo_texture")){
                 std::string tex_path = dir + "/" + (std::string)mat_config["albedo_texture"];
-                material->albedo_texture = TextureMap::load_file(tex_path);
+                material->albedo_texture = textures.load_file(tex_path);
             }
             material_map[name] = material;
         } else if (type == "reflection") {
             ReflectionMaterial* material = new ReflectionMaterial();
             if (mat_config.contains("albedo_texture")){
                 std::string tex_path = dir + "/" + (std::string)mat_config["albedo_texture"];
-                material->albedo_texture = TextureMap::load_file(tex_path);
+                material->albedo_texture = textures.load_file(tex_path);
             }
             material_map[name] = material;
         } else if (type == "emission") {
@@ -109,49 +248,102 @@ Scene Scene::load_file(std::string filepath){
         }
     }
     
+    /*
+    Each object is loaded, transformed and gets its own BVH in one task on the
+    pool, so a large asset's BVH build overlaps the loading of the others.
+    build() merges them in file order.
+    */
+    std::vector<json> object_configs;
     for (auto object: config["objects"]){
-        std::string mesh_path = dir + "/" + (std::string) object["path"];
+        object_configs.push_back(object);
+    }
+    scene.objects = std::make_shared<std::vector<SceneObject>>(object_configs.size());
+
+    TaskGroup group(ThreadPool::global());
+    for (size_t object_index = 0; object_index < object_configs.size(); object_index++){
+        group.run([&, object_index](){
+            json& object = object_configs[object_index];
+            SceneObject& loaded = (*scene.objects)[object_index];
+            std::vector<Mesh>& meshes = loaded.meshes;
+            std::string mesh_path = dir + "/" + (std::string) object["path"];
+            
+            glm::vec3 position = vector_to_vec3(object["transform"]["position"]);
+            glm::vec3 rotation = vector_to_vec3(object["transform"]["rotation"]);
+            float scale =  object["transform"]["scale"].get<float>();
+
+            glm::mat4 translate_m = glm::translate(position);
+            glm::mat4 rotation_m = glm::eulerAngleYXZ(glm::radians(rotation[1]), glm::radians(rotation[0]), glm::radians(rotation[2]));
+            glm::mat4 scale_m = glm::scale(glm::vec3(scale));
+            glm::mat4 transform = translate_m * rotation_m * scale_m;
         
-        glm::vec3 position = vector_to_vec3(object["transform"]["position"]);
-        glm::vec3 rotation = vector_to_vec3(object["transform"]["rotation"]);
-        float scale =  object["transform"]["scale"].get<float>();
-
-        glm::mat4 translate_m = glm::translate(position);
-        glm::mat4 rotation_m = glm::eulerAngleYXZ(glm::radians(rotation[1]), glm::radians(rotation[0]), glm::radians(rotation[2]));
-        glm::mat4 scale_m = glm::scale(glm::vec3(scale));
-        glm::mat4 transform = translate_m * rotation_m * scale_m;
-    
 
-    
-        if (object["type"] == "gltf"){
-            auto meshes = load_gltf(mesh_path);
-            for (auto mesh: meshes){
+        
+            if (object["type"] == "gltf"){
+                for (auto mesh: load_gltf(mesh_path, &textures)){
+                    mesh.applyTransform(transform);
+                    if (Mesh::compress_attributes){
+                        mesh.compress();
+                    }
+                    meshes.push_back(mesh);
+                }
+            } else {
+
+                Mesh mesh;
+                if (mesh_path.size() > 7 && mesh_path.compare(mesh_path.size() - 7, 7, ".rtmesh") == 0){
+                    if (!load_mesh_file(mesh_path, mesh)){
+                        throw std::runtime_error("invalid mesh file " + mesh_path);
+                    }
+                } else {
+                    mesh = Mesh::loadObj(mesh_path);
+                }
                 mesh.applyTransform(transform);
-                scene.meshes.push_back(mesh);
-            }
-        } else {
+                if (Mesh::compress_attributes){
+                    mesh.compress();
+                }
 
-            Mesh mesh = Mesh::loadObj(mesh_path);
-            mesh.applyTransform(transform);
+                //default material
+                DiffuseMaterial* material = new DiffuseMaterial();
+                material->albedo = glm::vec3(0.8f);
+                mesh.material = material;
+                
 
-            //default material
-            DiffuseMaterial* material = new DiffuseMaterial();
-            material->albedo = glm::vec3(0.8f);
-            mesh.material = material;
+                if (object.contains("material_ref")) {
+                    std::string material_name = object["material_ref"];
+                    if (!material_map.count(material_name)){
+                        throw std::runtime_error("unknown material " + material_name);
+                    }
+                    mesh.material = material_map.at(material_name);
+                    mesh.is_light = mesh.material->emmissive;
+                }
+                
+                if (object.count("light") > 0){
+                    mesh.is_light = object["light"].get<bool>();
+                } 
             
+                meshes.push_back(mesh);
+            }
 
-            if (object.contains("material_ref")) {
-                std::string material_name = object["material_ref"];
-                mesh.material = material_map[material_name];
-                mesh.is_light = mesh.material->emmissive;
+            for (Mesh& mesh : meshes){
+                for (size_t i = 0; i < mesh.face_indices.size(); i+=3){
+                    loaded.triangles.push_back(Triangle(&mesh, (int) i));
+                }
             }
-            
-            if (object.count("light") > 0){
-                mesh.is_light = object["light"].get<bool>();
-            } 
-        
-            scene.meshes.push_back(mesh);
+            if (!loaded.triangles.empty()){
+                BVH bvh(&loaded.triangles);
+                bvh.build();
+                loaded.root = bvh.root;
+                bvh.root = nullptr;
+            }
+        });
+    }
+    try {
+        group.wait();
+    } catch (...) {
+        //objects that did load still own their BVH nodes
+        for (SceneObject& object : *scene.objects){
+            scene.bvh.free_nodes(object.root);
         }
+        throw;
     }
     return scene;
 }
@@ -5,6 +5,7 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <memory>
 
 #include "glm/glm.hpp"
 #include "glm/gtx/euler_angles.hpp"
@@ -17,6 +18,8 @@
 
 using json = nlohmann::json;
 
+class TextureLoader;
+
 
 struct LightSample {
     Triangle light;
@@ -30,6 +33,13 @@ struct LightSample {
     LightSample(){};
 };
 
+//meshes of one scene object with a BVH over their triangles, built as soon as the object loads
+struct SceneObject {
+    std::vector<Mesh> meshes;
+    std::vector<Triangle> triangles;
+    BVHNode* root = nullptr;
+};
+
 class Scene {
     public:
         std::vector<Mesh> meshes;
@@ -37,10 +47,18 @@ class Scene {
         std::vector<Triangle> lights;
         BVH bvh;
         Camera camera;
+        //textures still decoding after load_file, waited for by build
+        std::shared_ptr<TextureLoader> texture_loads;
+        //objects built by load_file, merged into the scene by build
+        std::shared_ptr<std::vector<SceneObject>> objects;
         
         Scene(){};
         void build();
+        void replicate(const Scene& other);
+        size_t memory_usage() const;
+        void release_materials();
         void addMesh(Mesh& mesh);
+        void merge_objects();
         Triangle& pickLight(float r);
         LightSample sampleLight(IntersectionData& intersection);
         IntersectionData nearestIntersection(Ray& r);
@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "core/tile_scheduler.h"
+
+TileScheduler::TileScheduler(const std::vector<std::vector<RenderTile>>& runs): runs(runs.size()){
+    for (size_t i = 0; i < runs.size(); i++){
+        uint64_t begin = this->tiles.size();
+        this->tiles.insert(this->tiles.end(), runs[i].begin(), runs[i].end());
+        uint64_t end = this->tiles.size();
+        this->runs[i].bounds.store(begin | (end << 32));
+    }
+}
+
+bool TileScheduler::next(RenderTile& tile, int thread){
+    int n = this->runs.size();
+    if (n == 1){
+        uint64_t bounds = this->runs[0].bounds.fetch_add(1, std::memory_order_relaxed);
+        uint32_t begin = (uint32_t) bounds;
+        if (begin >= (uint32_t) (bounds >> 32)){
+            return false;
+        }
+        tile = this->tiles[begin];
+        return true;
+    }
+
+    int own = thread % n;
+    if (this->pop_front(own, tile)){
+        return true;
+    }
+    for (int i = 1; i < n; i++){
+        if (this->steal_back((own + i) % n, tile)){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TileScheduler::pop_front(int run, RenderTile& tile){
+    std::atomic<uint64_t>& bounds = this->runs[run].bounds;
+    uint64_t current = bounds.load(std::memory_order_relaxed);
+    while (true){
+        uint32_t begin = (uint32_t) current;
+        uint32_t end = (uint32_t) (current >> 32);
+        if (begin >= end){
+            return false;
+        }
+        if (bounds.compare_exchange_weak(current, current + 1, std::memory_order_relaxed)){
+            tile = this->tiles[begin];
+            return true;
+        }
+    }
+}
+
+bool TileScheduler::steal_back(int run, RenderTile& tile){
+    std::atomic<uint64_t>& bounds = this->runs[run].bounds;
+    uint64_t current = bounds.load(std::memory_order_relaxed);
+    while (true){
+        uint32_t begin = (uint32_t) current;
+        uint32_t end = (uint32_t) (current >> 32);
+        if (begin >= end){
+            return false;
+        }
+        if (bounds.compare_exchange_weak(current, current - (uint64_t(1) << 32), std::memory_order_relaxed)){
+            tile = this->tiles[end - 1];
+            return true;
+        }
+    }
+}
+
+//index of (x,y) along a hilbert curve filling an n x n grid, n a power of two
+static int hilbert_index(int n, int x, int y){
+    int d = 0;
+    for (int s = n / 2; s > 0; s /= 2){
+        int rx = (x & s) > 0;
+        int ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if (ry == 0){
+            if (rx == 1){
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+/*
+Reorders tiles so consecutive tiles are close on screen. "hilbert" follows a
+hilbert curve over the tile grid, "spiral" goes ring by ring outwards from
+the image centre, so previews fill in the middle first. "scanline" keeps the
+row major order.
+*/
+void order_tiles(std::vector<RenderTile>& tiles, const std::string& order, int width, int height, int tile_size){
+    if (order == "hilbert"){
+        int grid = std::max((width + tile_size - 1) / tile_size, (height + tile_size - 1) / tile_size);
+        int n = 1;
+        while (n < grid){
+            n *= 2;
+        }
+        std::stable_sort(tiles.begin(), tiles.end(), [n, tile_size](const RenderTile& a, const RenderTile& b){
+            return hilbert_index(n, a.x / tile_size, a.y / tile_size) < hilbert_index(n, b.x / tile_size, b.y / tile_size);
+        });
+    } else if (order == "spiral"){
+        auto ring = [width, height, tile_size](const RenderTile& t){
+            float dx = (t.x + t.w / 2.f - width / 2.f) / tile_size;
+            float dy = (t.y + t.h / 2.f - height / 2.f) / tile_size;
+            return (int) std::round(std::max(std::abs(dx), std::abs(dy)));
+        };
+        auto angle = [width, height](const RenderTile& t){
+            return std::atan2(t.y + t.h / 2.f - height / 2.f, t.x + t.w / 2.f - width / 2.f);
+        };
+        std::stable_sort(tiles.begin(), tiles.end(), [&](const RenderTile& a, const RenderTile& b){
+            int ra = ring(a);
+            int rb = ring(b);
+            return ra < rb || (ra == rb && angle(a) < angle(b));
+        });
+    } else if (order != "scanline"){
+        std::cerr << "Unknown tile order " << order << ", using scanline" << std::endl;
+    }
+}
+
+/*
+Splits the tiles handed out last into quarters, repeatedly, so the end of a
+pass is made of small tiles and threads run out of work at about the same
+time instead of waiting on a few large tiles. The head of the list is left
+at full size to keep per tile overhead low.
+*/
+std::vector<RenderTile> split_tail(const std::vector<RenderTile>& tiles, int num_threads, int min_size){
+    std::vector<RenderTile> result;
+    int tail = std::min((int) tiles.size(), 2 * num_threads);
+    int head = tiles.size() - tail;
+
+    result.insert(result.end(), tiles.begin(), tiles.begin() + head);
+
+    std::vector<RenderTile> last(tiles.begin() + head, tiles.end());
+    std::vector<RenderTile> split;
+    for (const RenderTile& tile : last){
+        if (tile.w < 2 * min_size || tile.h < 2 * min_size){
+            split.push_back(tile);
+            continue;
+        }
+        int w0 = tile.w / 2;
+        int h0 = tile.h / 2;
+        auto quarter = [&split, &tile](int w, int h, int x, int y){
+            RenderTile part = tile;
+            part.w = w;
+            part.h = h;
+            part.x = x;
+            part.y = y;
+            split.push_back(part);
+        };
+        quarter(w0, h0, tile.x, tile.y);
+        quarter(tile.w - w0, h0, tile.x + w0, tile.y);
+        quarter(w0, tile.h - h0, tile.x, tile.y + h0);
+        quarter(tile.w - w0, tile.h - h0, tile.x + w0, tile.y + h0);
+    }
+
+    //the first half of the quartered tiles goes out before the finest ones
+    if (split.size() > last.size() && num_threads > 1){
+        int keep = split.size() / 2;
+        std::vector<RenderTile> finest(split.begin() + keep, split.end());
+        result.insert(result.end(), split.begin(), split.begin() + keep);
+        std::vector<RenderTile> rest = split_tail(finest, num_threads, min_size);
+        result.insert(result.end(), rest.begin(), rest.end());
+        return result;
+    }
+
+    result.insert(result.end(), split.begin(), split.end());
+    return result;
+}
@@ -0,0 +1,47 @@
+#ifndef TILE_SCHEDULER_H_
+#define TILE_SCHEDULER_H_
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//samples are added to every unconverged pixel of the tile
+struct RenderTile {
+    int w, h, x, y;
+    int spp;
+    //index into the frames of a batch render
+    int frame = 0;
+};
+
+/*
+Hands out precomputed tile lists to the render threads without locks.
+With a single run every thread claims the next tile with one atomic
+increment. With several runs each thread owns one contiguous run, so it
+keeps tracing neighbouring tiles, and once its run is exhausted it steals
+from the back of the other runs.
+*/
+class TileScheduler {
+
+    //[begin, end) of a run packed in one word so owner and thieves agree on it
+    struct alignas(64) Run {
+        std::atomic<uint64_t> bounds;
+    };
+
+    public:
+        TileScheduler(const std::vector<std::vector<RenderTile>>& runs);
+        bool next(RenderTile& tile, int thread);
+
+    private:
+        std::vector<RenderTile> tiles;
+        std::vector<Run> runs;
+
+        bool pop_front(int run, RenderTile& tile);
+        bool steal_back(int run, RenderTile& tile);
+};
+
+void order_tiles(std::vector<RenderTile>& tiles, const std::string& order, int width, int height, int tile_size);
+std::vector<RenderTile> split_tail(const std::vector<RenderTile>& tiles, int num_threads, int min_size);
+
+#endif
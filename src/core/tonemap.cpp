@@ -0,0 +1,126 @@
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "core/tonemap.h"
+#include "util/thread_pool.h"
+
+bool ToneMapping::parse(const std::string& name, ToneOperator& op){
+    if (name == "reinhard"){
+        op = ToneOperator::Reinhard;
+    } else if (name == "aces"){
+        op = ToneOperator::Aces;
+    } else if (name == "exposure"){
+        op = ToneOperator::Exposure;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static float srgb_to_linear(float v){
+    return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+/*
+Linear to 8 bit sRGB. thresholds[k] is the linear value where the encoded
+value crosses k + 0.5, so the code of v is the number of thresholds <= v.
+A coarse table gives the code at the start of v's bucket, buckets are narrow
+enough that at most one more threshold can follow inside them.
+*/
+struct SrgbEncoder {
+    static const int buckets = 4096;
+    float thresholds[256];
+    unsigned char start[buckets + 1];
+
+    SrgbEncoder(){
+        for (int k = 0; k < 255; k++){
+            this->thresholds[k] = srgb_to_linear((k + 0.5f) / 255.f);
+        }
+        this->thresholds[255] = 2.f;
+        int code = 0;
+        for (int i = 0; i <= buckets; i++){
+            float v = (float) i / buckets;
+            while (v >= this->thresholds[code]){
+                code++;
+            }
+            this->start[i] = code;
+        }
+    }
+
+    //v in [0, 1]
+    unsigned char encode(float v) const {
+        int code = this->start[(int) (v * buckets)];
+        return code + (v >= this->thresholds[code]);
+    }
+};
+
+static const SrgbEncoder& srgb_encoder(){
+    static const SrgbEncoder encoder;
+    return encoder;
+}
+
+//applies the curve to n values in place, branch free inside the loops so they vectorise
+static void tone_curve(ToneOperator op, float scale, float* v, int n){
+    switch (op){
+        case ToneOperator::Reinhard:
+            for (int i = 0; i < n; i++){
+                float x = v[i] * scale;
+                v[i] = x / (x + 1.f);
+            }
+            break;
+        case ToneOperator::Aces:
+            //Narkowicz's fit of the ACES reference rendering transform
+            for (int i = 0; i < n; i++){
+                float x = v[i] * scale;
+                v[i] = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+            }
+            break;
+        case ToneOperator::Exposure:
+            for (int i = 0; i < n; i++){
+                v[i] = v[i] * scale;
+            }
+            break;
+    }
+    //NaN radiance maps to 0 instead of indexing the encoder table out of bounds
+    for (int i = 0; i < n; i++){
+        v[i] = v[i] > 0.f ? std::min(v[i], 1.f) : 0.f;
+    }
+}
+
+void tonemap_rect(const Film& film, const ToneMapping& mapping, int x, int y, int w, int h, unsigned char* rgba){
+    const SrgbEncoder& encoder = srgb_encoder();
+    float scale = std::exp2(mapping.exposure);
+
+    //one row of channel values at a time, laid out r..r g..g b..b
+    std::vector<float> row(w * 3);
+    float* r = row.data();
+    float* g = r + w;
+    float* b = g + w;
+    for (int py = y; py < y + h; py++){
+        int first = py * film.width + x;
+        for (int i = 0; i < w; i++){
+            int n = film.samples[first + i];
+            float inv = n > 0 ? 1.f / n : 0.f;
+            const glm::vec3& sum = film.accumulator[first + i];
+            r[i] = sum.x * inv;
+            g[i] = sum.y * inv;
+            b[i] = sum.z * inv;
+        }
+        tone_curve(mapping.op, scale, row.data(), w * 3);
+
+        unsigned char* out = rgba + (size_t) first * 4;
+        for (int i = 0; i < w; i++){
+            out[i * 4]     = encoder.encode(r[i]);
+            out[i * 4 + 1] = encoder.encode(g[i]);
+            out[i * 4 + 2] = encoder.encode(b[i]);
+            out[i * 4 + 3] = 255;
+        }
+    }
+}
+
+void film_to_rgba8(const Film& film, const ToneMapping& mapping, unsigned char* rgba){
+    ThreadPool::global().parallel_for(0, film.height, 16, [&](int y_begin, int y_end){
+        tonemap_rect(film, mapping, 0, y_begin, film.width, y_end - y_begin, rgba);
+    });
+}
@@ -0,0 +1,30 @@
+#ifndef TONEMAP_H_
+#define TONEMAP_H_
+
+#include <string>
+
+#include "core/film.h"
+
+enum class ToneOperator { Reinhard, Aces, Exposure };
+
+/*
+Display transform for 8 bit output: exposure in stops, a tone curve
+(Reinhard, the ACES filmic fit, or plain exposure with clipping) and the
+sRGB transfer function. Quantization goes through a threshold table, so
+every value lands on the same code as rounding the exact sRGB curve.
+*/
+struct ToneMapping {
+    ToneOperator op = ToneOperator::Reinhard;
+    float exposure = 0.f;
+
+    //"reinhard", "aces" or "exposure", false for anything else
+    static bool parse(const std::string& name, ToneOperator& op);
+};
+
+//tonemaps the w x h block at film pixel (x, y) into rgba, a film.width * film.height * 4 byte image
+void tonemap_rect(const Film& film, const ToneMapping& mapping, int x, int y, int w, int h, unsigned char* rgba);
+
+//whole film, blocks of rows run on the thread pool
+void film_to_rgba8(const Film& film, const ToneMapping& mapping, unsigned char* rgba);
+
+#endif
@@ -34,6 +34,11 @@ struct IntersectionData {
     glm::vec3 tangent;
     glm::vec3 bitangent;
     glm::vec2 tex_coord;
+
+    //change of position and uv towards the neighbouring pixels, zero without ray differentials
+    bool has_differentials = false;
+    glm::vec3 dpdx = glm::vec3(0.f), dpdy = glm::vec3(0.f);
+    glm::vec2 duvdx = glm::vec2(0.f), duvdy = glm::vec2(0.f);
 };
 
 inline bool rayBBoxIntersection(const Ray& r, const BBox& box, float* t){
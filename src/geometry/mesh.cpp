@@ -3,140 +3,397 @@
 #include "tinyobjloader/tiny_obj_loader.h"
 
 #include "geometry/mesh.h"
+#include "util/thread_pool.h"
+#include "util/mapped_file.h"
 
 #include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 void Mesh::compute_tangents(){
-    tangents.resize(vertices.size());
-    bitangents.resize(vertices.size());
-    for (unsigned int i = 0; i < vertices.size(); i++){
-        tangents[i] = glm::vec3(0.0f);
-        bitangents[i] = glm::vec3(0.0f);
-    }
+    ThreadPool& pool = ThreadPool::global();
+    tangents.assign(vertices.size(), glm::vec3(0.0f));
+    bitangents.assign(vertices.size(), glm::vec3(0.0f));
+
+    //per face tangents in parallel, summed into the vertices afterwards
+    int n_faces = face_indices.size() / 3;
+    std::vector<glm::vec3> face_tangents(n_faces);
+    std::vector<glm::vec3> face_bitangents(n_faces);
+
     //http://foundationsofgameenginedev.com/FGED2-sample.pdf
-    for (unsigned int i = 0; i < face_indices.size(); i += 3) {
-        glm::vec3 p0 = vertices[face_indices[i]];
-        glm::vec3 p1 = vertices[face_indices[i+1]];
-        glm::vec3 p2 = vertices[face_indices[i+2]];
+    pool.parallel_for(0, n_faces, 4096, [&](int begin, int end){
+        for (int f = begin; f < end; f++) {
+            unsigned int i = f * 3;
+            glm::vec3 p0 = vertices[face_indices[i]];
+            glm::vec3 p1 = vertices[face_indices[i+1]];
+            glm::vec3 p2 = vertices[face_indices[i+2]];
+            
+            glm::vec2 w0 = tex_coords[face_indices[i]];
+            glm::vec2 w1 = tex_coords[face_indices[i+1]];
+            glm::vec2 w2 = tex_coords[face_indices[i+2]];
+
+            glm::vec3 e1 = p1 - p0;
+            glm::vec3 e2 = p2 - p0;
+
+            float x1 = w1.x - w0.x;
+            float x2 = w2.x - w0.x;
+            float y1 = w1.y - w0.y;
+            float y2 = w2.y - w0.y;
+
         
-        glm::vec2 w0 = tex_coords[face_indices[i]];
-        glm::vec2 w1 = tex_coords[face_indices[i+1]];
-        glm::vec2 w2 = tex_coords[face_indices[i+2]];
+            float r = 1.0f/(x1 * y2 - x2 * y1);
+            face_tangents[f] = (e1 * y2 - e2 * y1) * r;
+            face_bitangents[f] = (e2 * x1 - e1 * x2) * r;
+        }
+    });
 
-        glm::vec3 e1 = p1 - p0;
-        glm::vec3 e2 = p2 - p0;
+    for (int f = 0; f < n_faces; f++) {
+        unsigned int i = f * 3;
+        tangents[face_indices[i]] += face_tangents[f];
+        tangents[face_indices[i+1]] += face_tangents[f];
+        tangents[face_indices[i+2]] += face_tangents[f];
 
-        float x1 = w1.x - w0.x;
-        float x2 = w2.x - w0.x;
-        float y1 = w1.y - w0.y;
-        float y2 = w2.y - w0.y;
+        bitangents[face_indices[i]] += face_bitangents[f];
+        bitangents[face_indices[i+1]] += face_bitangents[f];
+        bitangents[face_indices[i+2]] += face_bitangents[f];
+    }
 
-    
-        float r = 1.0f/(x1 * y2 - x2 * y1);
-        glm::vec3 tangent = (e1 * y2 - e2 * y1) * r;
-        glm::vec3 bitangent = (e2 * x1 - e1 * x2) * r;
+    pool.parallel_for(0, vertices.size(), 4096, [&](int begin, int end){
+        for (int i = begin; i < end; i++){
+            tangents[i] = glm::normalize(tangents[i]);
+            bitangents[i] = glm::normalize(bitangents[i]);
+        }
+    });
+}
 
 
-        tangents[face_indices[i]] += tangent;
-        tangents[face_indices[i+1]] += tangent;
-        tangents[face_indices[i+2]] += tangent;
+bool Mesh::compress_attributes = false;
 
-        bitangents[face_indices[i]] += bitangent;
-        bitangents[face_indices[i+1]] += bitangent;
-        bitangents[face_indices[i+2]] += bitangent;
+void Mesh::compress(){
+    if (this->compressed){
+        return;
     }
-     for(int i = 0; i < vertices.size(); i++){
-        tangents[i] = glm::normalize(tangents[i]);
-        bitangents[i] = glm::normalize(bitangents[i]);
-
-        if (glm::dot(glm::cross(tangents[i], bitangents[i]), normals[i]) < 0.0f) {
-           // bitangents[i] = -bitangents[i];
-            
+    size_t n = this->vertices.size();
+    this->packed_normals.resize(n);
+    this->packed_tangents.resize(n);
+    this->packed_tex_coords.resize(this->tex_coords.empty() ? 0 : n);
+    ThreadPool::global().parallel_for(0, n, 4096, [&](int begin, int end){
+        for (int i = begin; i < end; i++){
+            glm::vec3 normal = this->normals[i];
+            glm::vec3 tangent = this->tangents[i];
+            bool flipped = glm::dot(glm::cross(normal, tangent), this->bitangents[i]) < 0.f;
+            this->packed_normals[i] = glm::packSnorm2x16(oct_encode(normal));
+            this->packed_tangents[i] = (glm::packSnorm2x16(oct_encode(tangent)) & ~1u) | (flipped ? 1u : 0u);
+            if (!this->tex_coords.empty()){
+                this->packed_tex_coords[i] = glm::packHalf2x16(this->tex_coords[i]);
+            }
         }
-     
-       
-     }
-   
+    });
+    std::vector<glm::vec3>().swap(this->normals);
+    std::vector<glm::vec3>().swap(this->tangents);
+    std::vector<glm::vec3>().swap(this->bitangents);
+    std::vector<glm::vec2>().swap(this->tex_coords);
+    this->compressed = true;
 }
 
+size_t Mesh::memory_usage() const {
+    return this->vertices.size() * sizeof(glm::vec3)
+        + (this->normals.size() + this->tangents.size() + this->bitangents.size()) * sizeof(glm::vec3)
+        + this->tex_coords.size() * sizeof(glm::vec2)
+        + (this->packed_normals.size() + this->packed_tangents.size() + this->packed_tex_coords.size()) * sizeof(uint32_t)
+        + this->face_indices.size() * sizeof(unsigned int);
+}
 
+//meshes are transformed before they are compressed
 void Mesh::applyTransform(glm::mat4 transform){
     glm::mat4 transform_normal = glm::inverse(glm::transpose(transform));
-    for(int i = 0; i < vertices.size(); i++){
-        this->vertices[i] = transform * glm::vec4(this->vertices[i], 1.0);
-        this->tangents[i] = glm::normalize(transform * glm::vec4(this->tangents[i], 0.0));
-        this->bitangents[i] = glm::normalize(transform_normal * glm::vec4(this->bitangents[i], 0.0));
-        this->normals[i] = glm::normalize(transform_normal * glm::vec4(this->normals[i], 0.0));
+    ThreadPool::global().parallel_for(0, vertices.size(), 4096, [&](int begin, int end){
+        for(int i = begin; i < end; i++){
+            this->vertices[i] = transform * glm::vec4(this->vertices[i], 1.0);
+            this->tangents[i] = glm::normalize(transform * glm::vec4(this->tangents[i], 0.0));
+            this->bitangents[i] = glm::normalize(transform_normal * glm::vec4(this->bitangents[i], 0.0));
+            this->normals[i] = glm::normalize(transform_normal * glm::vec4(this->normals[i], 0.0));
+        }
+    });
+}
+
+/*
+OBJ files are parsed in chunks of whole lines on the thread pool. A first
+pass counts the elements of each chunk so the second can parse straight
+into preallocated arrays, resolving relative indices against the counts
+before each chunk. Numbers are read with tinyobj's own parser and
+polygons are fanned like tinyobj does, so the result matches loading the
+file with it.
+*/
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+    size_t v = 0, vn = 0, vt = 0, corners = 0;
+};
+
+//indices of a triangle corner into the position, texcoord and normal arrays, -1 if missing
+struct ObjCorner {
+    int v, vt, vn;
+    bool operator==(const ObjCorner& other) const {
+        return this->v == other.v && this->vt == other.vt && this->vn == other.vn;
+    }
+};
+
+//calls line(text) for each line of [begin, end) as a null terminated string
+template <typename F>
+static void for_each_obj_line(const char* begin, const char* end, F line){
+    std::string buffer;
+    while (begin < end){
+        const char* next = (const char*) std::memchr(begin, '\n', end - begin);
+        if (next == nullptr){
+            next = end;
+        }
+        buffer.assign(begin, next);
+        const char* token = buffer.c_str();
+        token += strspn(token, " \t");
+        line(token);
+        begin = next + 1;
+    }
+}
+
+static size_t count_face_vertices(const char* token){
+    size_t n = 0;
+    while (!IS_NEW_LINE(token[0])){
+        token += strcspn(token, " \t\r");
+        token += strspn(token, " \t\r");
+        n++;
     }
+    return n;
+}
+
+static void count_obj_chunk(ObjChunk& chunk){
+    for_each_obj_line(chunk.begin, chunk.end, [&](const char* token){
+        if (token[0] == 'v' && IS_SPACE(token[1])){
+            chunk.v++;
+        } else if (token[0] == 'v' && token[1] == 'n' && IS_SPACE(token[2])){
+            chunk.vn++;
+        } else if (token[0] == 'v' && token[1] == 't' && IS_SPACE(token[2])){
+            chunk.vt++;
+        } else if (token[0] == 'f' && IS_SPACE(token[1])){
+            token += 2;
+            token += strspn(token, " \t");
+            size_t n = count_face_vertices(token);
+            chunk.corners += n > 2 ? (n - 2) * 3 : 0;
+        }
+    });
+}
+
+//offsets are the element counts of the chunks before this one
+static void parse_obj_chunk(const ObjChunk& chunk, const ObjChunk& offsets, glm::vec3* positions, glm::vec3* normals, glm::vec2* tex_coords, ObjCorner* corners){
+    int v = offsets.v, vn = offsets.vn, vt = offsets.vt;
+    size_t corner = offsets.corners;
+    std::vector<tinyobj::vertex_index> face;
+    for_each_obj_line(chunk.begin, chunk.end, [&](const char* token){
+        if (token[0] == 'v' && IS_SPACE(token[1])){
+            token += 2;
+            glm::vec3& p = positions[v++];
+            tinyobj::parseReal3(&p.x, &p.y, &p.z, &token);
+        } else if (token[0] == 'v' && token[1] == 'n' && IS_SPACE(token[2])){
+            token += 3;
+            glm::vec3& n = normals[vn++];
+            tinyobj::parseReal3(&n.x, &n.y, &n.z, &token);
+        } else if (token[0] == 'v' && token[1] == 't' && IS_SPACE(token[2])){
+            token += 3;
+            glm::vec2& uv = tex_coords[vt++];
+            tinyobj::parseReal2(&uv.x, &uv.y, &token);
+        } else if (token[0] == 'f' && IS_SPACE(token[1])){
+            token += 2;
+            token += strspn(token, " \t");
+            face.clear();
+            while (!IS_NEW_LINE(token[0])){
+                face.push_back(tinyobj::parseTriple(&token, v, vn, vt));
+                token += strspn(token, " \t\r");
+            }
+            //triangle fan
+            for (size_t k = 2; k < face.size(); k++){
+                for (const tinyobj::vertex_index& i : {face[0], face[k - 1], face[k]}){
+                    corners[corner++] = {i.v_idx, i.vt_idx, i.vn_idx};
+                }
+            }
+        }
+    });
+}
+
+static uint32_t hash_corner(const ObjCorner& c){
+    uint64_t h = (uint64_t) (uint32_t) c.v * 0x9E3779B97F4A7C15ull;
+    h ^= (uint64_t) (uint32_t) c.vt * 0xC2B2AE3D27D4EB4Full + (h >> 29);
+    h ^= (uint64_t) (uint32_t) c.vn * 0x165667B19E3779F9ull + (h >> 32);
+    return (uint32_t) (h ^ (h >> 31));
 }
 
 Mesh Mesh::loadObj(std::string filename){
     Mesh mesh;
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string err;
-
-    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename.c_str());
-
-    //operator overload for std::map
-    auto compare_idx = [](const tinyobj::index_t& a, const tinyobj::index_t& b) {
-        return a.vertex_index < b.vertex_index ||
-            (a.vertex_index == b.vertex_index && a.normal_index < b.normal_index) ||
-            (a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index < b.texcoord_index);
+    ThreadPool& pool = ThreadPool::global();
+
+    MappedFile file;
+    if (!file.open(filename)){
+        std::cerr << "could not open obj file " << filename << std::endl;
+        return mesh;
+    }
+    const char* data = (const char*) file.data();
+    const char* data_end = data + file.size();
+
+    //chunks end after a newline
+    size_t chunk_size = std::max<size_t>(1 << 20, file.size() / (pool.size() * 4) + 1);
+    std::vector<ObjChunk> chunks;
+    for (const char* begin = data; begin < data_end;){
+        const char* end = begin + std::min(chunk_size, (size_t) (data_end - begin));
+        const char* newline = end < data_end ? (const char*) std::memchr(end, '\n', data_end - end) : nullptr;
+        end = newline != nullptr ? newline + 1 : data_end;
+        chunks.push_back({begin, end});
+        begin = end;
+    }
+
+    pool.parallel_for(0, chunks.size(), 1, [&](int begin, int end){
+        for (int i = begin; i < end; i++){
+            count_obj_chunk(chunks[i]);
+        }
+    });
+    std::vector<ObjChunk> offsets(chunks.size() + 1);
+    for (size_t i = 0; i < chunks.size(); i++){
+        offsets[i + 1].v = offsets[i].v + chunks[i].v;
+        offsets[i + 1].vn = offsets[i].vn + chunks[i].vn;
+        offsets[i + 1].vt = offsets[i].vt + chunks[i].vt;
+        offsets[i + 1].corners = offsets[i].corners + chunks[i].corners;
+    }
+    const ObjChunk& totals = offsets.back();
+
+    std::vector<glm::vec3> positions(totals.v);
+    std::vector<glm::vec3> normals(totals.vn);
+    std::vector<glm::vec2> tex_coords(totals.vt);
+    std::vector<ObjCorner> corners(totals.corners);
+    pool.parallel_for(0, chunks.size(), 1, [&](int begin, int end){
+        for (int i = begin; i < end; i++){
+            parse_obj_chunk(chunks[i], offsets[i], positions.data(), normals.data(), tex_coords.data(), corners.data());
+        }
+    });
+    file.close();
+
+    //indices outside the elements in the file fail the load, absent vt/vn are -1
+    auto in_range = [](int index, size_t n, bool optional){
+        return (optional && index == -1) || (index >= 0 && (size_t) index < n);
     };
+    std::atomic<bool> valid(true);
+    pool.parallel_for(0, corners.size(), 4096, [&](int begin, int end){
+        for (int c = begin; c < end; c++){
+            const ObjCorner& corner = corners[c];
+            if (!in_range(corner.v, totals.v, false) || !in_range(corner.vt, totals.vt, true) || !in_range(corner.vn, totals.vn, true)){
+                valid = false;
+            }
+        }
+    });
+    if (!valid){
+        std::cerr << "invalid face index in obj file " << filename << std::endl;
+        return mesh;
+    }
 
-     std::map<tinyobj::index_t, int,decltype(compare_idx)> unique_vertices(compare_idx);
+    /*
+    Vertices are numbered in the order their (v, vt, vn) triple first appears.
+    An open addressing table maps each triple to the smallest corner using
+    it, filled concurrently with CAS (a slot only ever moves to a smaller
+    corner of the same triple). Corners that are their triple's first get
+    the next vertex number by a prefix sum in corner order.
+    */
+    int n_corners = corners.size();
+    const uint32_t empty = UINT32_MAX;
+    size_t table_size = 1;
+    while (table_size < (size_t) n_corners + n_corners / 2 + 1){
+        table_size <<= 1;
+    }
+    size_t mask = table_size - 1;
+    std::unique_ptr<std::atomic<uint32_t>[]> table(new std::atomic<uint32_t>[table_size]);
+    pool.parallel_for(0, table_size, 1 << 16, [&](int begin, int end){
+        for (int i = begin; i < end; i++){
+            table[i].store(empty, std::memory_order_relaxed);
+        }
+    });
 
-    bool has_tex_coords = attrib.texcoords.size() > 0;
-    int current_idx = 0;
-     // copy face indices
-    for (size_t s = 0; s < shapes.size(); s++) {
-        size_t index_offset = 0;
-        
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-            int fv = shapes[s].mesh.num_face_vertices[f];
-
-            // Loop over vertices in the face.
-            for (size_t v = 0; v < fv; v++) {
-                // access to vertex
-                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-
-                auto it = unique_vertices.find(idx);
-
-                if (it != unique_vertices.end()) {
-                    mesh.face_indices.push_back(it->second);
-                } else {
-                  
-                    tinyobj::real_t vx = attrib.vertices[3*idx.vertex_index+0];
-                    tinyobj::real_t vy = attrib.vertices[3*idx.vertex_index+1];
-                    tinyobj::real_t vz = attrib.vertices[3*idx.vertex_index+2];
-                    tinyobj::real_t nx = attrib.normals[3*idx.normal_index+0];
-                    tinyobj::real_t ny = attrib.normals[3*idx.normal_index+1];
-                    tinyobj::real_t nz = attrib.normals[3*idx.normal_index+2];
-
-                    tinyobj::real_t tx, ty;
-                    if (has_tex_coords){
-                        tx = attrib.texcoords[2*idx.texcoord_index+0];
-                        ty = attrib.texcoords[2*idx.texcoord_index+1];
-                    } else {
-                        tx = 0.0f;
-                        ty = 0.0f;
+    std::vector<uint32_t> first(n_corners);
+    pool.parallel_for(0, n_corners, 4096, [&](int begin, int end){
+        for (int c = begin; c < end; c++){
+            size_t slot = hash_corner(corners[c]) & mask;
+            while (true){
+                uint32_t current = table[slot].load(std::memory_order_relaxed);
+                if (current == empty){
+                    if (table[slot].compare_exchange_weak(current, c)){
+                        break;
                     }
-                 
+                    continue;
+                }
+                if (corners[current] == corners[c]){
+                    while ((uint32_t) c < current && !table[slot].compare_exchange_weak(current, c)){}
+                    break;
+                }
+                slot = (slot + 1) & mask;
+            }
+        }
+    });
+    pool.parallel_for(0, n_corners, 4096, [&](int begin, int end){
+        for (int c = begin; c < end; c++){
+            size_t slot = hash_corner(corners[c]) & mask;
+            while (!(corners[table[slot].load(std::memory_order_relaxed)] == corners[c])){
+                slot = (slot + 1) & mask;
+            }
+            first[c] = table[slot].load(std::memory_order_relaxed);
+        }
+    });
+    table.reset();
 
-                    mesh.face_indices.push_back(current_idx);
-                    mesh.vertices.push_back(glm::vec3(vx, vy, vz));
-                    mesh.normals.push_back(glm::vec3(nx, ny, nz));
-                    mesh.tex_coords.push_back(glm::vec2(tx, ty));
+    //vertex numbers of first corners, counted per block then offset by the blocks before
+    const int block = 1 << 16;
+    int n_blocks = (n_corners + block - 1) / block;
+    std::vector<uint32_t> block_offsets(n_blocks + 1, 0);
+    pool.parallel_for(0, n_blocks, 1, [&](int begin, int end){
+        for (int b = begin; b < end; b++){
+            uint32_t count = 0;
+            for (int c = b * block; c < std::min(n_corners, (b + 1) * block); c++){
+                count += first[c] == (uint32_t) c;
+            }
+            block_offsets[b + 1] = count;
+        }
+    });
+    for (int b = 0; b < n_blocks; b++){
+        block_offsets[b + 1] += block_offsets[b];
+    }
+    size_t n_vertices = block_offsets[n_blocks];
 
-                    unique_vertices.insert(std::pair<tinyobj::index_t, int>(idx, current_idx));
-                    current_idx += 1;
+    mesh.vertices.resize(n_vertices);
+    mesh.normals.resize(n_vertices);
+    mesh.tex_coords.resize(n_vertices);
+    mesh.face_indices.resize(n_corners);
+    pool.parallel_for(0, n_blocks, 1, [&](int begin, int end){
+        for (int b = begin; b < end; b++){
+            uint32_t vertex = block_offsets[b];
+            for (int c = b * block; c < std::min(n_corners, (b + 1) * block); c++){
+                if (first[c] != (uint32_t) c){
+                    continue;
                 }
+                //the first corner's slot in face_indices holds its vertex until the last pass
+                const ObjCorner& corner = corners[c];
+                mesh.face_indices[c] = vertex;
+                mesh.vertices[vertex] = positions[corner.v];
+                mesh.normals[vertex] = corner.vn >= 0 ? normals[corner.vn] : glm::vec3(0.0f);
+                mesh.tex_coords[vertex] = corner.vt >= 0 ? tex_coords[corner.vt] : glm::vec2(0.0f);
+                vertex++;
             }
-            index_offset += fv;
         }
-    }
+    });
+    pool.parallel_for(0, n_corners, 4096, [&](int begin, int end){
+        for (int c = begin; c < end; c++){
+            if (first[c] != (uint32_t) c){
+                mesh.face_indices[c] = mesh.face_indices[first[c]];
+            }
+        }
+    });
+
     mesh.compute_tangents();
     return mesh;
-}
\ No newline at end of file
+}
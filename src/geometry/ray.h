@@ -6,6 +6,9 @@
 class Ray {
     public:
         glm::vec3 origin,direction;
+        //rays through the neighbouring pixels in x and y, used for texture footprints
+        bool has_differentials = false;
+        glm::vec3 rx_origin, rx_direction, ry_origin, ry_direction;
         Ray(): origin(glm::vec3()), direction(glm::vec3()) {}
         Ray(glm::vec3 origin, glm::vec3 direction): origin(origin), direction(direction) {} 
 };
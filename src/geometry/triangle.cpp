@@ -36,9 +36,9 @@ glm::vec3 Triangle::normal(glm::vec2 barycentric){
     float u = barycentric.x;
     float v = barycentric.y;
 
-    glm::vec3 n0 = this->mesh->normals[this->mesh->face_indices[this->face_offset]];
-    glm::vec3 n1 = this->mesh->normals[this->mesh->face_indices[this->face_offset + 1]];
-    glm::vec3 n2 = this->mesh->normals[this->mesh->face_indices[this->face_offset + 2]];
+    glm::vec3 n0 = this->mesh->normal(this->mesh->face_indices[this->face_offset]);
+    glm::vec3 n1 = this->mesh->normal(this->mesh->face_indices[this->face_offset + 1]);
+    glm::vec3 n2 = this->mesh->normal(this->mesh->face_indices[this->face_offset + 2]);
 
     return glm::normalize((n1 * u) + (n2 * v) + (n0 * (1 - u -v)));
 }
@@ -48,9 +48,9 @@ glm::vec3 Triangle::tangent(glm::vec2 barycentric){
     float u = barycentric.x;
     float v = barycentric.y;
 
-    glm::vec3 t0 = this->mesh->tangents[this->mesh->face_indices[this->face_offset]];
-    glm::vec3 t1 = this->mesh->tangents[this->mesh->face_indices[this->face_offset + 1]];
-    glm::vec3 t2 = this->mesh->tangents[this->mesh->face_indices[this->face_offset + 2]];
+    glm::vec3 t0 = this->mesh->tangent(this->mesh->face_indices[this->face_offset]);
+    glm::vec3 t1 = this->mesh->tangent(this->mesh->face_indices[this->face_offset + 1]);
+    glm::vec3 t2 = this->mesh->tangent(this->mesh->face_indices[this->face_offset + 2]);
 
     return glm::normalize((t1 * u) + (t2 * v) + (t0 * (1 - u -v)));
 }
@@ -59,9 +59,9 @@ glm::vec3 Triangle::bitangent(glm::vec2 barycentric){
         float u = barycentric.x;
         float v = barycentric.y;
     
-        glm::vec3 b0 = this->mesh->bitangents[this->mesh->face_indices[this->face_offset]];
-        glm::vec3 b1 = this->mesh->bitangents[this->mesh->face_indices[this->face_offset + 1]];
-        glm::vec3 b2 = this->mesh->bitangents[this->mesh->face_indices[this->face_offset + 2]];
+        glm::vec3 b0 = this->mesh->bitangent(this->mesh->face_indices[this->face_offset]);
+        glm::vec3 b1 = this->mesh->bitangent(this->mesh->face_indices[this->face_offset + 1]);
+        glm::vec3 b2 = this->mesh->bitangent(this->mesh->face_indices[this->face_offset + 2]);
     
         return glm::normalize((b1 * u) + (b2 * v) + (b0 * (1 - u -v)));
 }
@@ -83,9 +83,9 @@ glm::vec2 Triangle::tex_coords(glm::vec2 barycentric){
     float u = barycentric.x;
     float v = barycentric.y;
 
-    glm::vec2 t0 = this->mesh->tex_coords[this->mesh->face_indices[this->face_offset]];
-    glm::vec2 t1 = this->mesh->tex_coords[this->mesh->face_indices[this->face_offset + 1]];
-    glm::vec2 t2 = this->mesh->tex_coords[this->mesh->face_indices[this->face_offset + 2]];
+    glm::vec2 t0 = this->mesh->tex_coord(this->mesh->face_indices[this->face_offset]);
+    glm::vec2 t1 = this->mesh->tex_coord(this->mesh->face_indices[this->face_offset + 1]);
+    glm::vec2 t2 = this->mesh->tex_coord(this->mesh->face_indices[this->face_offset + 2]);
 
     return t1 * u + t2 * v + t0 * (1 - u - v);
 }
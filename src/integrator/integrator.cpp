@@ -0,0 +1,69 @@
+#include "integrator/integrator.h"
+#include "core/render.h"
+
+
+void compute_differentials(IntersectionData& intersection, const Ray& ray){
+    Mesh* mesh = intersection.triangle.mesh;
+    int face_offset = intersection.triangle.face_offset;
+    glm::vec3 n = intersection.face_normal;
+    glm::vec3 p = intersection.position;
+
+    float dx = glm::dot(n, ray.rx_direction);
+    float dy = glm::dot(n, ray.ry_direction);
+    if (std::abs(dx) < 1e-8f || std::abs(dy) < 1e-8f){
+        return;
+    }
+    float d = glm::dot(n, p);
+    intersection.dpdx = ray.rx_origin + ray.rx_direction * ((d - glm::dot(n, ray.rx_origin)) / dx) - p;
+    intersection.dpdy = ray.ry_origin + ray.ry_direction * ((d - glm::dot(n, ray.ry_origin)) / dy) - p;
+    intersection.has_differentials = true;
+    if (!mesh->has_tex_coords()){
+        return;
+    }
+
+    //dp in the edge basis by least squares, then the same barycentric change applied to the uvs
+    glm::vec3 v0 = mesh->vertices[mesh->face_indices[face_offset]];
+    glm::vec3 e1 = mesh->vertices[mesh->face_indices[face_offset + 1]] - v0;
+    glm::vec3 e2 = mesh->vertices[mesh->face_indices[face_offset + 2]] - v0;
+    glm::vec2 t0 = mesh->tex_coord(mesh->face_indices[face_offset]);
+    glm::vec2 t1 = mesh->tex_coord(mesh->face_indices[face_offset + 1]) - t0;
+    glm::vec2 t2 = mesh->tex_coord(mesh->face_indices[face_offset + 2]) - t0;
+
+    float a11 = glm::dot(e1, e1);
+    float a12 = glm::dot(e1, e2);
+    float a22 = glm::dot(e2, e2);
+    float det = a11 * a22 - a12 * a12;
+    if (std::abs(det) < 1e-20f){
+        return;
+    }
+    auto uv_change = [&](const glm::vec3& dp){
+        float r1 = glm::dot(e1, dp);
+        float r2 = glm::dot(e2, dp);
+        return t1 * ((a22 * r1 - a12 * r2) / det) + t2 * ((a11 * r2 - a12 * r1) / det);
+    };
+    intersection.duvdx = uv_change(intersection.dpdx);
+    intersection.duvdy = uv_change(intersection.dpdy);
+}
+
+void Integrator::render_tile(const RenderTile& tile, Scene& scene, const Camera& camera, const RenderConfig& config, Film& film){
+    for (int y = tile.y; y < tile.y + tile.h; y++){
+        for (int x = tile.x; x < tile.x + tile.w; x++){
+            int index = film.index(x, y);
+            if (film.converged[index]){
+                continue;
+            }
+
+            for (int s = 0; s < tile.spp; s++){
+                seed_sample(x, y, config.sample_offset + film.samples[index], 0, config.frame_index + tile.frame);
+                Ray camera_ray = generate_camera_ray(camera, config, x, y);
+                if (film.has_aovs){
+                    PrimaryAovs aovs;
+                    film.add_sample(index, this->trace(camera_ray, scene, &aovs));
+                    film.add_aovs(index, aovs.albedo, aovs.normal, aovs.depth);
+                } else {
+                    film.add_sample(index, this->trace(camera_ray, scene));
+                }
+            }
+        }
+    }
+}
@@ -12,10 +12,66 @@
 #include "shading/material.h"
 #include "shading/materials/all.h"
 
+struct RenderConfig;
+struct RenderTile;
+class Film;
+
+
+//offsets of the differential rays on the hit's plane and the uv change they cause
+void compute_differentials(IntersectionData& intersection, const Ray& ray);
+
+//interpolates shading normal (flipped towards the ray), uvs and tangent frame at a hit
+inline void setup_shading_frame(IntersectionData& intersection, const Ray& ray){
+    glm::vec3 normal = intersection.triangle.normal(intersection.barycentric);
+
+    if (glm::dot(ray.direction, normal) >= 0.0f){
+        normal *= -1.f;
+    }
+
+    intersection.normal = normal;
+    intersection.tex_coord = intersection.triangle.tex_coords(intersection.barycentric);
+    intersection.tangent = intersection.triangle.tangent(intersection.barycentric);
+    intersection.bitangent = intersection.triangle.bitangent(intersection.barycentric);
+    if (ray.has_differentials){
+        compute_differentials(intersection, ray);
+    }
+}
+
+/*
+Next ray of a path leaving the hit. Mirror bounces keep the ray differentials,
+mapped like the mirror BSDF maps wo and treating the surface as flat; other
+bounces drop them and sample textures at full resolution.
+*/
+inline Ray spawn_ray(const IntersectionData& intersection, const Ray& ray, const glm::vec3& direction, const glm::vec3& normal, bool mirror){
+    Ray next(intersection.position, direction);
+    if (mirror && intersection.has_differentials){
+        next.has_differentials = true;
+        next.rx_origin = intersection.position + intersection.dpdx;
+        next.ry_origin = intersection.position + intersection.dpdy;
+        next.rx_direction = glm::reflect(-ray.rx_direction, normal);
+        next.ry_direction = glm::reflect(-ray.ry_direction, normal);
+    }
+    return next;
+}
+
+//albedo, shading normal and distance of a path's first hit, zero if the camera ray escapes
+struct PrimaryAovs {
+    glm::vec3 albedo = glm::vec3(0.f);
+    glm::vec3 normal = glm::vec3(0.f);
+    float depth = 0.f;
+};
+
 
 class Integrator {
     public:
-        virtual glm::vec3 trace(Ray& ray, Scene& scene) = 0;
+        virtual ~Integrator(){}
+        //fills aovs from the path's own first hit when given
+        virtual glm::vec3 trace(Ray& ray, Scene& scene, PrimaryAovs* aovs = nullptr) = 0;
+        //called once before tiles are handed to the render threads
+        virtual void prepare(Scene&, const RenderConfig&){}
+        virtual void render_tile(const RenderTile& tile, Scene& scene, const Camera& camera, const RenderConfig& config, Film& film);
+        //true if render_tile keeps state per pixel across calls, frames then can't be rendered concurrently
+        virtual bool has_pixel_history() const { return false; }
 };
 
 /*
@@ -72,7 +128,9 @@ class NeePathTracer: public Integrator {
     public:
 
         NeePathTracer(){};
-        glm::vec3 trace(Ray& ray, Scene& scene);
+        glm::vec3 trace(Ray& ray, Scene& scene, PrimaryAovs* aovs = nullptr);
+        //continues a path whose first `bounce` vertices were already shaded by the caller
+        glm::vec3 trace_path(Ray& ray, Scene& scene, int bounce, PrimaryAovs* aovs = nullptr);
 };
 
 #endif
\ No newline at end of file
@@ -1,15 +1,19 @@
 #include "integrator/integrator.h"
 
 
-glm::vec3 NeePathTracer::trace(Ray& primary_ray, Scene& scene){
+glm::vec3 NeePathTracer::trace(Ray& primary_ray, Scene& scene, PrimaryAovs* aovs){
+    return this->trace_path(primary_ray, scene, 0, aovs);
+}
+
+glm::vec3 NeePathTracer::trace_path(Ray& primary_ray, Scene& scene, int bounce, PrimaryAovs* aovs){
 
     glm::vec3 radiance = glm::vec3(0.f);
     glm::vec3 throughput = glm::vec3(1.f);
     
-    Ray scatter_ray = Ray(primary_ray.origin, primary_ray.direction);
+    Ray scatter_ray = primary_ray;
     bool specular_bounce = false;
 
-    for (int i = 0; i < 5; i++){
+    for (int i = bounce; i < 5; i++){
         
         IntersectionData intersection = scene.bvh.nearestIntersection(scatter_ray);
      
@@ -23,6 +27,12 @@ glm::vec3 NeePathTracer::trace(Ray& primary_ray, Scene& scene){
 
 
         if (intersection.triangle.mesh->is_light){
+            if (i == bounce && aovs != nullptr){
+                setup_shading_frame(intersection, scatter_ray);
+                aovs->albedo = glm::min(static_cast<EmissionMaterial*>(material)->emission, glm::vec3(1.f));
+                aovs->normal = intersection.normal;
+                aovs->depth = intersection.t;
+            }
             if (i == 0){
                 return  static_cast<EmissionMaterial*>(material)->emission * throughput;
             } else if (specular_bounce){
@@ -31,21 +41,14 @@ glm::vec3 NeePathTracer::trace(Ray& primary_ray, Scene& scene){
             break;
         }
 
-        bool backface = false;
-        
-        glm::vec3 normal = intersection.triangle.normal(intersection.barycentric);
-     
-        if (glm::dot(scatter_ray.direction, normal) >= 0.0f){
-            normal *= -1.f;
-            backface = true;
-        }
-
-        intersection.normal = normal;
-        intersection.tex_coord = intersection.triangle.tex_coords(intersection.barycentric);
-        intersection.tangent = intersection.triangle.tangent(intersection.barycentric);
-        intersection.bitangent = intersection.triangle.bitangent(intersection.barycentric);
+        setup_shading_frame(intersection, scatter_ray);
      
         BSDF* bsdf = material->create_shader(intersection);
+        if (i == bounce && aovs != nullptr){
+            aovs->albedo = bsdf->albedo;
+            aovs->normal = bsdf->normal;
+            aovs->depth = intersection.t;
+        }
 
          //direct lighting    
         if (bsdf->sample_light){
@@ -78,7 +81,7 @@ glm::vec3 NeePathTracer::trace(Ray& primary_ray, Scene& scene){
         //indirect lighting
         BSDFSample sample = bsdf->sample(-scatter_ray.direction);
         throughput *= sample.throughput / sample.pdf;
-        scatter_ray = Ray(intersection.position, sample.direction);
+        scatter_ray = spawn_ray(intersection, scatter_ray, sample.direction, bsdf->normal, specular_bounce);
         delete bsdf;
     }
 
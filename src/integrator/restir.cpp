@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cmath>
+
+#include "integrator/restir.h"
+#include "core/render.h"
+
+
+RestirPathTracer::RestirPathTracer(int candidates, int spatial_samples, int spatial_radius){
+    this->candidates = candidates;
+    this->spatial_samples = spatial_samples;
+    this->spatial_radius = spatial_radius;
+}
+
+void RestirPathTracer::prepare(Scene&, const RenderConfig& config){
+    //history is kept between render calls so progressive passes keep reusing it
+    if (this->width != config.width || this->history.size() != (size_t) config.width * config.height){
+        this->width = config.width;
+        this->history.assign(config.width * config.height, Reservoir());
+    }
+}
+
+void RestirPathTracer::render_tile(const RenderTile& tile, Scene& scene, const Camera& camera, const RenderConfig& config, Film& film){
+    int n = tile.w * tile.h;
+    std::vector<PixelHit> hits(n);
+    std::vector<Reservoir> spatial(n);
+
+    for (int s = 0; s < tile.spp; s++){
+
+        //initial candidates, temporal reuse and visibility reuse
+        for (int ty = 0; ty < tile.h; ty++){
+            for (int tx = 0; tx < tile.w; tx++){
+                PixelHit& hit = hits[ty * tile.w + tx];
+                hit = PixelHit();
+                int index = film.index(tile.x + tx, tile.y + ty);
+                if (film.converged[index]){
+                    continue;
+                }
+                seed_sample(tile.x + tx, tile.y + ty, config.sample_offset + film.samples[index], 0, config.frame_index + tile.frame);
+
+                Ray camera_ray = generate_camera_ray(camera, config, tile.x + tx, tile.y + ty);
+                this->primary_hit(camera_ray, scene, hit);
+                if (film.has_aovs){
+                    film.add_aovs(index, hit.aovs.albedo, hit.aovs.normal, hit.aovs.depth);
+                }
+                if (!hit.shade){
+                    continue;
+                }
+
+                this->sample_candidates(scene, hit);
+
+                Reservoir& previous = this->history[(tile.y + ty) * config.width + tile.x + tx];
+                this->reuse(hit.reservoir, previous, hit, this->max_history * this->candidates);
+                hit.reservoir.finalize();
+
+                if (hit.reservoir.W > 0.f && !this->visible(scene, hit.reservoir.sample, hit)){
+                    hit.reservoir.W = 0.f;
+                }
+            }
+        }
+
+        //spatial reuse between pixels of this tile
+        for (int ty = 0; ty < tile.h; ty++){
+            for (int tx = 0; tx < tile.w; tx++){
+                PixelHit& hit = hits[ty * tile.w + tx];
+                Reservoir& reservoir = spatial[ty * tile.w + tx];
+                reservoir = hit.reservoir;
+                if (!hit.shade){
+                    continue;
+                }
+                int index = film.index(tile.x + tx, tile.y + ty);
+                seed_sample(tile.x + tx, tile.y + ty, config.sample_offset + film.samples[index], 1, config.frame_index + tile.frame);
+
+                for (int k = 0; k < this->spatial_samples; k++){
+                    int nx = tx + (int) ((randuf() * 2.f - 1.f) * this->spatial_radius);
+                    int ny = ty + (int) ((randuf() * 2.f - 1.f) * this->spatial_radius);
+                    if (nx < 0 || ny < 0 || nx >= tile.w || ny >= tile.h || (nx == tx && ny == ty)){
+                        continue;
+                    }
+                    PixelHit& neighbour = hits[ny * tile.w + nx];
+                    if (!neighbour.shade || !this->compatible(hit, neighbour)){
+                        continue;
+                    }
+                    this->reuse(reservoir, neighbour.reservoir, hit, this->max_history * this->candidates);
+                }
+                reservoir.finalize();
+            }
+        }
+
+        //shading
+        for (int ty = 0; ty < tile.h; ty++){
+            for (int tx = 0; tx < tile.w; tx++){
+                int index = film.index(tile.x + tx, tile.y + ty);
+                if (film.converged[index]){
+                    continue;
+                }
+                PixelHit& hit = hits[ty * tile.w + tx];
+                glm::vec3 radiance = hit.radiance;
+
+                if (hit.shade){
+                    seed_sample(tile.x + tx, tile.y + ty, config.sample_offset + film.samples[index], 2, config.frame_index + tile.frame);
+                    Reservoir& reservoir = spatial[ty * tile.w + tx];
+                    radiance += this->shade(scene, hit, reservoir);
+                    this->history[(tile.y + ty) * config.width + tile.x + tx] = reservoir;
+                    delete hit.bsdf;
+                }
+                film.add_sample(index, radiance);
+            }
+        }
+    }
+}
+
+void RestirPathTracer::primary_hit(Ray& ray, Scene& scene, PixelHit& hit){
+    IntersectionData intersection = scene.bvh.nearestIntersection(ray);
+    if (!intersection.hit){
+        return;
+    }
+
+    Material* material = intersection.triangle.mesh->material;
+    setup_shading_frame(intersection, ray);
+    hit.aovs.depth = intersection.t;
+    if (intersection.triangle.mesh->is_light){
+        hit.radiance = static_cast<EmissionMaterial*>(material)->emission;
+        hit.aovs.albedo = glm::min(hit.radiance, glm::vec3(1.f));
+        hit.aovs.normal = intersection.normal;
+        return;
+    }
+
+    BSDF* bsdf = material->create_shader(intersection);
+    hit.aovs.albedo = bsdf->albedo;
+    hit.aovs.normal = bsdf->normal;
+
+    //specular surfaces can't use light samples, fall back to the plain path tracer
+    if (!bsdf->sample_light){
+        delete bsdf;
+        hit.radiance = NeePathTracer::trace(ray, scene);
+        return;
+    }
+
+    hit.shade = true;
+    hit.intersection = intersection;
+    hit.wo = -ray.direction;
+    hit.bsdf = bsdf;
+}
+
+void RestirPathTracer::sample_candidates(Scene& scene, PixelHit& hit){
+    for (int i = 0; i < this->candidates; i++){
+        LightSample candidate = scene.sampleLight(hit.intersection);
+        //zero area light triangles would put inf/NaN weights in the reservoir
+        if (!(candidate.pdf > 0.f) || std::isinf(candidate.pdf)){
+            continue;
+        }
+        float target = this->target_pdf(candidate, hit);
+        hit.reservoir.update(candidate, target / candidate.pdf, target, randuf());
+    }
+}
+
+void RestirPathTracer::reuse(Reservoir& reservoir, const Reservoir& other, PixelHit& hit, float max_M){
+    if (other.M <= 0.f){
+        return;
+    }
+    //nothing selected (or occluded), only the candidate count carries over
+    if (other.W <= 0.f){
+        reservoir.M += std::min(other.M, max_M);
+        return;
+    }
+    LightSample candidate = this->retarget(other.sample, hit);
+    float target = this->target_pdf(candidate, hit);
+    reservoir.merge(other, candidate, target, std::min(other.M, max_M), randuf());
+}
+
+bool RestirPathTracer::compatible(PixelHit& a, PixelHit& b){
+    if (glm::dot(a.intersection.normal, b.intersection.normal) < 0.9f){
+        return false;
+    }
+    return std::abs(a.intersection.t - b.intersection.t) < 0.1f * a.intersection.t;
+}
+
+float RestirPathTracer::target_pdf(const LightSample& sample, PixelHit& hit){
+    glm::vec3 bsdf_eval = hit.bsdf->eval(hit.wo, sample.direction);
+    float solid_angle = glm::dot(sample.direction, sample.normal) / (sample.distance * sample.distance);
+    EmissionMaterial* emissive_material = static_cast<EmissionMaterial*>(sample.light.mesh->material);
+    return std::max(luminance(emissive_material->emission * bsdf_eval * solid_angle), 0.f);
+}
+
+bool RestirPathTracer::visible(Scene& scene, const LightSample& sample, PixelHit& hit){
+    Ray shadow_ray = Ray(hit.intersection.position, sample.direction);
+    return !scene.bvh.isOccluded(shadow_ray, sample.distance - .0001f);
+}
+
+LightSample RestirPathTracer::retarget(const LightSample& sample, PixelHit& hit){
+    LightSample retargeted = sample;
+    glm::vec3 offset = sample.position - hit.intersection.position;
+    retargeted.distance = glm::length(offset);
+    retargeted.direction = offset / retargeted.distance;
+    return retargeted;
+}
+
+glm::vec3 RestirPathTracer::shade(Scene& scene, PixelHit& hit, Reservoir& reservoir){
+    glm::vec3 radiance = glm::vec3(0.f);
+
+    //direct lighting from the resampled light sample
+    if (reservoir.W > 0.f && this->visible(scene, reservoir.sample, hit)){
+        LightSample& light_sample = reservoir.sample;
+        glm::vec3 bsdf_eval = hit.bsdf->eval(hit.wo, light_sample.direction);
+        float solid_angle = glm::dot(light_sample.direction, light_sample.normal) / (light_sample.distance * light_sample.distance);
+        EmissionMaterial* emissive_material = static_cast<EmissionMaterial*>(light_sample.light.mesh->material);
+
+        glm::vec3 direct_lighting = emissive_material->emission * bsdf_eval * solid_angle * reservoir.W;
+        radiance += glm::max(direct_lighting, 0.f);
+    }
+
+    //indirect lighting
+    BSDFSample sample = hit.bsdf->sample(hit.wo);
+    glm::vec3 throughput = sample.throughput / sample.pdf;
+    Ray scatter_ray = Ray(hit.intersection.position, sample.direction);
+    radiance += throughput * this->trace_path(scatter_ray, scene, 1);
+
+    return radiance;
+}
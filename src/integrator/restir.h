@@ -0,0 +1,93 @@
+#ifndef RESTIR_H_
+#define RESTIR_H_
+
+#include <vector>
+
+#include "integrator/integrator.h"
+
+/*
+Weighted reservoir over light samples (Bitterli et al. 2020, "Spatiotemporal
+reservoir resampling for real-time ray tracing with dynamic direct lighting").
+w_sum is the running sum of resampling weights, M the number of candidates
+streamed through the reservoir and W the contribution weight of the selected
+sample, 1/p for the selected sample in the limit of many candidates.
+*/
+struct Reservoir {
+    LightSample sample;
+    float target = 0.f;
+    float w_sum = 0.f;
+    float M = 0.f;
+    float W = 0.f;
+
+    bool update(const LightSample& candidate, float weight, float candidate_target, float r){
+        this->w_sum += weight;
+        this->M += 1.f;
+        if (weight > 0.f && r * this->w_sum <= weight){
+            this->sample = candidate;
+            this->target = candidate_target;
+            return true;
+        }
+        return false;
+    }
+
+    //merges another reservoir whose sample has been re-evaluated at this pixel
+    bool merge(const Reservoir& other, const LightSample& candidate, float candidate_target, float M, float r){
+        float m = this->M;
+        bool picked = this->update(candidate, candidate_target * other.W * M, candidate_target, r);
+        this->M = m + M;
+        return picked;
+    }
+
+    void finalize(){
+        this->W = (this->target > 0.f) ? this->w_sum / (this->M * this->target) : 0.f;
+    }
+};
+
+
+/*
+Path tracer which replaces next event estimation at the primary hit with
+resampled importance sampling over many light candidates. Reservoirs are
+reused temporally (per pixel, across samples and successive render calls)
+and spatially (between neighbouring pixels of the same tile), so one shadow
+ray per pixel sample gets close to the quality of many. Reuse uses the
+biased 1/M normalization. Secondary bounces use regular NEE.
+*/
+class RestirPathTracer: public NeePathTracer {
+
+    //primary hit of one pixel of the tile being rendered
+    struct PixelHit {
+        bool shade = false;
+        glm::vec3 radiance = glm::vec3(0.f);
+        IntersectionData intersection;
+        glm::vec3 wo;
+        BSDF* bsdf = nullptr;
+        Reservoir reservoir;
+        PrimaryAovs aovs;
+    };
+
+    public:
+        int candidates = 32;
+        int spatial_samples = 4;
+        int spatial_radius = 8;
+        float max_history = 20.f;
+        int width = 0;
+        std::vector<Reservoir> history;
+
+        RestirPathTracer(){};
+        RestirPathTracer(int candidates, int spatial_samples, int spatial_radius);
+        void prepare(Scene& scene, const RenderConfig& config);
+        void render_tile(const RenderTile& tile, Scene& scene, const Camera& camera, const RenderConfig& config, Film& film);
+        bool has_pixel_history() const { return true; }
+
+    private:
+        void primary_hit(Ray& ray, Scene& scene, PixelHit& hit);
+        void sample_candidates(Scene& scene, PixelHit& hit);
+        void reuse(Reservoir& reservoir, const Reservoir& other, PixelHit& hit, float max_M);
+        bool compatible(PixelHit& a, PixelHit& b);
+        float target_pdf(const LightSample& sample, PixelHit& hit);
+        bool visible(Scene& scene, const LightSample& sample, PixelHit& hit);
+        LightSample retarget(const LightSample& sample, PixelHit& hit);
+        glm::vec3 shade(Scene& scene, PixelHit& hit, Reservoir& reservoir);
+};
+
+#endif
@@ -4,6 +4,13 @@
 #include <vector>
 #include <thread>
 #include <chrono>
+#include <mutex>
+#include <fstream>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <memory>
 
 //#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
@@ -12,12 +19,196 @@
 #include "core/camera.h"
 #include "core/scene.h"
 #include "core/render.h"
+#include "core/checkpoint.h"
+#include "core/output.h"
+#include "core/denoise.h"
+#include "shading/texture_cache.h"
+#include "assets/gtlf_loader.h"
+#include "assets/mesh_file.h"
 #include "integrator/integrator.h"
+#include "integrator/restir.h"
 #include "util/progress_bar.h"
+#include "util/thread_pool.h"
+#include "server/render_server.h"
 
+//output.png -> output_0001.png, or printf style patterns like frame_%03d.png
+static std::string frame_output_path(const std::string& output, int frame){
+    if (output.find('%') != std::string::npos){
+        char path[1024];
+        std::snprintf(path, sizeof(path), output.c_str(), frame);
+        return path;
+    }
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%04d", frame);
+    size_t dot = output.find_last_of('.');
+    size_t slash = output.find_last_of("\\/");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)){
+        return output + number;
+    }
+    return output.substr(0, dot) + number + output.substr(dot);
+}
+
+//parses comma separated integers like "0,0,256,128"
+static std::vector<int> parse_int_list(const std::string& list){
+    std::vector<int> values;
+    std::stringstream stream(list);
+    std::string value;
+    while (std::getline(stream, value, ',')){
+        values.push_back(std::stoi(value));
+    }
+    return values;
+}
+
+//float output options shared by rendering and merge
+static void add_output_arguments(argparse::ArgumentParser& cli){
+    cli.add_argument("--aovs").default_value(std::string("")).help("AOVs for .exr/.pfm output, comma separated (albedo, normal, depth, samples)");
+    cli.add_argument("--exr-float").default_value(false).implicit_value(true).help("Write 32 bit float instead of half EXR channels");
+    cli.add_argument("--exr-compression").default_value(std::string("zip")).help("EXR compression (none, zips, zip)");
+    cli.add_argument("--tonemap").default_value(std::string("reinhard")).help("Tone curve for 8 bit output (reinhard, aces, exposure)");
+    cli.add_argument("--denoise").default_value(false).implicit_value(true).help("Filter the frame with the albedo/normal/depth guided denoiser");
+    cli.add_argument("--exposure").default_value(0.f).help("Exposure in stops applied before tonemapping").scan<'g', float>();
+}
+
+static bool read_output_arguments(argparse::ArgumentParser& cli, RenderConfig& config){
+    std::stringstream aovs(cli.get<std::string>("--aovs"));
+    std::string aov;
+    while (std::getline(aovs, aov, ',')){
+        if (!aov.empty()){
+            config.aovs.push_back(aov);
+        }
+    }
+    config.exr_half = !cli.get<bool>("--exr-float");
+    config.exr_compression = cli.get<std::string>("--exr-compression");
+    config.denoise = cli.get<bool>("--denoise");
+    config.tonemap.exposure = cli.get<float>("--exposure");
+    if (!ToneMapping::parse(cli.get<std::string>("--tonemap"), config.tonemap.op)){
+        std::cout << "unknown tonemap " << cli.get<std::string>("--tonemap") << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//raytracer-cpp merge -o image.png part0.rtp part1.rtp ...
+static int merge_main(int argc, char** argv){
+    argparse::ArgumentParser cli("raytracer-cpp merge");
+    cli.add_argument("-o","--output").default_value(std::string("output.png")).help("Output file");
+    add_output_arguments(cli);
+    cli.add_argument("partials").remaining().help("Partial buffers written by --region, --tile-range or --sample-range renders");
+
+    try {
+        cli.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error& err) {
+        std::cout << err.what() << std::endl;
+        std::cout << cli;
+        std::exit(0);
+    }
+
+    std::vector<std::string> partials;
+    try {
+        partials = cli.get<std::vector<std::string>>("partials");
+    } catch (const std::logic_error&) {
+        std::cout << "no partial buffers given" << std::endl;
+        return 1;
+    }
+
+    Film film;
+    for (const std::string& path : partials){
+        Film partial;
+        int spp;
+        if (!load_checkpoint(path, partial, spp)){
+            std::cout << "invalid partial buffer: " << path << std::endl;
+            return 1;
+        }
+        if (film.width == 0){
+            film = Film(partial.width, partial.height);
+        }
+        if (partial.width != film.width || partial.height != film.height){
+            std::cout << "resolution mismatch: " << path << std::endl;
+            return 1;
+        }
+        film.merge(partial);
+        std::cout << "merged " << path << std::endl;
+    }
+
+    RenderConfig config;
+    if (!read_output_arguments(cli, config)){
+        return 1;
+    }
+    if (config.denoise){
+        if (!film.has_aovs){
+            std::cout << "partial buffers have no AOVs, render them with --denoise to denoise the merge" << std::endl;
+            return 1;
+        }
+        denoise_film(film);
+    }
+    if (!write_film(cli.get<std::string>("--output"), film, config)){
+        std::cout << "could not write " << cli.get<std::string>("--output") << std::endl;
+        return 1;
+    }
+    std::cout << "average spp: " << (double) film.total_samples() / (film.width * film.height) << std::endl;
+    return 0;
+}
+
+//raytracer-cpp convert -o mesh.rtmesh model.obj
+static int convert_main(int argc, char** argv){
+    argparse::ArgumentParser cli("raytracer-cpp convert");
+    cli.add_argument("-o","--output").required().help("Binary mesh file to write (.rtmesh)");
+    cli.add_argument("--quantize").default_value(false).implicit_value(true).help("Store normals and tangents octahedral encoded and uvs as half floats");
+    cli.add_argument("input").help("OBJ, glTF or GLB file, glTF primitives are merged into one mesh");
+
+    try {
+        cli.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error& err) {
+        std::cout << err.what() << std::endl;
+        std::cout << cli;
+        std::exit(0);
+    }
+
+    std::string input = cli.get<std::string>("input");
+    std::string extension = input.substr(input.find_last_of('.') + 1);
+    Mesh mesh;
+    if (extension == "gltf" || extension == "glb"){
+        //materials and textures stay with the scene, only geometry is converted
+        for (const Mesh& part : load_gltf(input, nullptr)){
+            unsigned int offset = mesh.vertices.size();
+            mesh.vertices.insert(mesh.vertices.end(), part.vertices.begin(), part.vertices.end());
+            mesh.normals.insert(mesh.normals.end(), part.normals.begin(), part.normals.end());
+            mesh.tex_coords.insert(mesh.tex_coords.end(), part.tex_coords.begin(), part.tex_coords.end());
+            mesh.tangents.insert(mesh.tangents.end(), part.tangents.begin(), part.tangents.end());
+            mesh.bitangents.insert(mesh.bitangents.end(), part.bitangents.begin(), part.bitangents.end());
+            //parts missing an attribute get zeros so the arrays stay aligned
+            mesh.normals.resize(mesh.vertices.size());
+            mesh.tex_coords.resize(mesh.vertices.size());
+            mesh.tangents.resize(mesh.vertices.size());
+            mesh.bitangents.resize(mesh.vertices.size());
+            for (unsigned int index : part.face_indices){
+                mesh.face_indices.push_back(index + offset);
+            }
+        }
+    } else {
+        mesh = Mesh::loadObj(input);
+    }
+
+    std::string output = cli.get<std::string>("--output");
+    if (!save_mesh_file(output, mesh, cli.get<bool>("--quantize"))){
+        std::cout << "could not write " << output << std::endl;
+        return 1;
+    }
+    std::cout << mesh.vertices.size() << " vertices, " << mesh.face_indices.size() / 3 << " triangles written to " << output << std::endl;
+    return 0;
+}
 
 int main(int argc, char** argv){
 
+    if (argc > 1 && std::string(argv[1]) == "merge"){
+        return merge_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "convert"){
+        return convert_main(argc - 1, argv + 1);
+    }
+
     argparse::ArgumentParser cli("raytracer-cpp");
     cli.add_argument("-o","--output").default_value(std::string("output.png")).help("Output file");
     cli.add_argument("-s","--scene").help("Scene file to render");
@@ -25,6 +216,34 @@ int main(int argc, char** argv){
     cli.add_argument("-h","--height").default_value(512).help("Height of output image").scan<'i', int>();
     cli.add_argument("--spp").default_value(64).help("Number of samples per pixel").scan<'i', int>();
     cli.add_argument("--tile-size").default_value(16).help("Tile Size").scan<'i', int>();
+    cli.add_argument("--tile-order").default_value(std::string("scanline")).help("Tile order (scanline, hilbert, spiral)");
+    cli.add_argument("--tile-runs").default_value(false).implicit_value(true).help("Give each thread a contiguous run of tiles, stealing when done");
+    cli.add_argument("--threads").default_value(0).help("Number of render threads, 0 for all cores").scan<'i', int>();
+    cli.add_argument("--numa").default_value(false).implicit_value(true).help("Pin threads to NUMA nodes and replicate scene data per node");
+    cli.add_argument("--adaptive").default_value(0.f).help("Relative error at which pixels stop sampling, 0 disables adaptive sampling").scan<'g', float>();
+    cli.add_argument("--min-spp").default_value(16).help("Samples per adaptive pass").scan<'i', int>();
+    cli.add_argument("--progressive").default_value(false).implicit_value(true).help("Render the whole frame in passes of increasing spp");
+    cli.add_argument("--time-limit").default_value(0.0).help("Stop progressive rendering after this many seconds").scan<'g', double>();
+    cli.add_argument("--noise-target").default_value(0.f).help("Stop progressive rendering once the mean relative error is below this").scan<'g', float>();
+    cli.add_argument("--integrator").default_value(std::string("nee")).help("Integrator (nee, restir)");
+    cli.add_argument("--restir-candidates").default_value(32).help("Light candidates per pixel sample for restir").scan<'i', int>();
+    cli.add_argument("--checkpoint").default_value(std::string("")).help("Periodically save the render state to this file");
+    cli.add_argument("--checkpoint-interval").default_value(300.0).help("Seconds between checkpoints").scan<'g', double>();
+    cli.add_argument("--resume").default_value(false).implicit_value(true).help("Continue from the --checkpoint file if it exists");
+    add_output_arguments(cli);
+    cli.add_argument("--region").help("Render only x0,y0,x1,y1 and write a partial buffer to --output");
+    cli.add_argument("--tile-range").help("Render only tiles first,end of the scanline tile list and write a partial buffer");
+    cli.add_argument("--sample-range").help("Render only samples first,end of every pixel and write a partial buffer");
+    cli.add_argument("--cameras").help("JSON camera list or camera path, renders one image per camera");
+    cli.add_argument("--interleave").default_value(false).implicit_value(true).help("Render tiles of all --cameras frames from one queue");
+    cli.add_argument("--stream").default_value(false).implicit_value(true).help("Write tiles to a tiled .exr --output as they finish instead of keeping the whole film");
+    cli.add_argument("--serve").help("Run as a render daemon listening on this Unix socket path");
+    cli.add_argument("--cache-mb").default_value(4096).help("Memory cap for scenes kept resident by the daemon").scan<'i', int>();
+    cli.add_argument("--texture-cache-mb").default_value(0).help("Page textures in tiles from .rttex files next to them under this memory cap, 0 keeps them in memory").scan<'i', int>();
+    cli.add_argument("--compress-attributes").default_value(false).implicit_value(true).help("Keep normals and tangents octahedral encoded and uvs as half floats, about a third of the shading data");
+    cli.add_argument("--texture-layout").default_value(std::string("morton")).help("In memory texel order (scanline, morton)");
+    cli.add_argument("--texture-filter").default_value(std::string("trilinear")).help("Texture lookup (point, trilinear, ewa)");
+    cli.add_argument("--restir-spatial").default_value(4).help("Spatial neighbours reused per pixel sample for restir").scan<'i', int>();
 
     try {
         cli.parse_args(argc, argv);
@@ -39,66 +258,237 @@ int main(int argc, char** argv){
     config.width = cli.get<int>("--width");
     config.height = cli.get<int>("--height");
     config.spp = cli.get<int>("--spp");
-    config.scene_file = cli.get<std::string>("--scene");
     config.output_file = cli.get<std::string>("--output");
     config.tile_size = cli.get<int>("--tile-size");
-    config.num_threads = std::thread::hardware_concurrency();
+    config.num_threads = cli.get<int>("--threads");
+    if (config.num_threads <= 0){
+        config.num_threads = std::thread::hardware_concurrency();
+    }
+    config.numa = cli.get<bool>("--numa");
+    config.tile_order = cli.get<std::string>("--tile-order");
+    config.tile_runs = cli.get<bool>("--tile-runs");
+    config.interleave = cli.get<bool>("--interleave");
+    config.integrator = cli.get<std::string>("--integrator");
+    TextureCache::global().budget = (size_t) cli.get<int>("--texture-cache-mb") * 1024 * 1024;
+    Mesh::compress_attributes = cli.get<bool>("--compress-attributes");
+    if (!TextureMap::parse_layout(cli.get<std::string>("--texture-layout"), TextureMap::default_layout)){
+        std::cout << "unknown texture layout " << cli.get<std::string>("--texture-layout") << std::endl;
+        return 1;
+    }
+    if (!TextureMap::parse_filter(cli.get<std::string>("--texture-filter"), TextureMap::filter)){
+        std::cout << "unknown texture filter " << cli.get<std::string>("--texture-filter") << std::endl;
+        return 1;
+    }
+    config.adaptive_threshold = cli.get<float>("--adaptive");
+    config.min_spp = cli.get<int>("--min-spp");
+    config.time_limit = cli.get<double>("--time-limit");
+    config.noise_target = cli.get<float>("--noise-target");
+    config.progressive = cli.get<bool>("--progressive") || config.time_limit > 0.0 || config.noise_target > 0.f;
+    config.checkpoint_file = cli.get<std::string>("--checkpoint");
+    config.checkpoint_interval = cli.get<double>("--checkpoint-interval");
+    if (!read_output_arguments(cli, config)){
+        return 1;
+    }
+
+    bool partial = false;
+    try {
+        if (auto region = cli.present<std::string>("--region")){
+            std::vector<int> r = parse_int_list(*region);
+            if (r.size() != 4 || r[0] >= r[2] || r[1] >= r[3]){
+                throw std::invalid_argument("--region needs x0,y0,x1,y1");
+            }
+            config.region_x0 = r[0]; config.region_y0 = r[1];
+            config.region_x1 = r[2]; config.region_y1 = r[3];
+            partial = true;
+        }
+        if (auto range = cli.present<std::string>("--tile-range")){
+            std::vector<int> r = parse_int_list(*range);
+            if (r.size() != 2 || r[0] < 0 || r[0] >= r[1]){
+                throw std::invalid_argument("--tile-range needs first,end");
+            }
+            config.tile_begin = r[0];
+            config.tile_end = r[1];
+            partial = true;
+        }
+        if (auto range = cli.present<std::string>("--sample-range")){
+            std::vector<int> r = parse_int_list(*range);
+            if (r.size() != 2 || r[0] < 0 || r[0] >= r[1]){
+                throw std::invalid_argument("--sample-range needs first,end");
+            }
+            config.sample_offset = r[0];
+            config.spp = r[1] - r[0];
+            partial = true;
+        }
+    } catch (const std::invalid_argument& err) {
+        std::cout << err.what() << std::endl;
+        return 1;
+    }
+
+    bool stream = cli.get<bool>("--stream");
+    if (stream){
+        std::string extension = config.output_file.size() >= 4 ? config.output_file.substr(config.output_file.size() - 4) : "";
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (extension != ".exr"){
+            std::cout << "--stream needs an .exr output" << std::endl;
+            return 1;
+        }
+        //every tile is finished in one go, nothing can revisit it later
+        if (partial || config.progressive || config.adaptive_threshold > 0.f || !config.checkpoint_file.empty() || config.denoise || cli.present<std::string>("--cameras").has_value()){
+            std::cout << "--stream can't be combined with progressive, adaptive, checkpointed, partial, denoised or multi camera renders" << std::endl;
+            return 1;
+        }
+    }
+
+    //the waiting thread helps run tasks, so the pool needs one thread less
+    ThreadPool::init(config.num_threads - 1);
+
+    if (auto socket_path = cli.present<std::string>("--serve")){
+        RenderServer server(config, (size_t) cli.get<int>("--cache-mb") * 1024 * 1024);
+        return server.run(*socket_path) ? 0 : 1;
+    }
+    config.scene_file = cli.get<std::string>("--scene");
 
     std::cout << config.scene_file << std::endl;
     std::cout << config.output_file << std::endl;
     std::cout << config.width << "x" << config.height << " " << config.spp << "spp" << std::endl;
     std::cout << config.tile_size << "x" <<  config.tile_size << " tiles" << std::endl;
     std::cout << config.num_threads << " threads available" << std::endl;
+    std::cout << config.integrator << " integrator" << std::endl;
   
     //Scene scene = Scene::load_gltf(config.scene_file);
    
     
-    Scene scene = Scene::load_file(config.scene_file);
-    
-
-    scene.camera.aspect_ratio = float(config.width)/float(config.height);
-    scene.build();
+    //unreadable scene files, meshes and textures end the run with an error
+    std::unique_ptr<Scene> loaded;
+    try {
+        loaded.reset(new Scene(Scene::load_file(config.scene_file)));
+        loaded->camera.aspect_ratio = float(config.width)/float(config.height);
+        loaded->build();
+    } catch (const std::exception& err){
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+    Scene& scene = *loaded;
 
     std::cout <<"# Tris: "<< scene.triangles.size() << std::endl;
     
-    NeePathTracer integrator;
-    glm::vec3 *accumulator = new glm::vec3[config.width * config.height];
+    Integrator* integrator;
+    if (config.integrator == "restir"){
+        integrator = new RestirPathTracer(cli.get<int>("--restir-candidates"), cli.get<int>("--restir-spatial"), 8);
+    } else {
+        integrator = new NeePathTracer();
+    }
+
+    if (auto cameras_file = cli.present<std::string>("--cameras")){
+        std::ifstream file(*cameras_file);
+        json cameras_config;
+        file >> cameras_config;
+        std::vector<Camera> cameras = Camera::path_from_json(cameras_config);
+        std::cout << "rendering " << cameras.size() << " frames" << std::endl;
+
+        std::mutex print_mutex;
+        render_batch(*integrator, scene, config, cameras, [&](int frame, Film& film){
+            std::string path = frame_output_path(config.output_file, frame);
+            if (config.denoise){
+                denoise_film(film);
+            }
+            write_film(path, film, config);
+            std::lock_guard<std::mutex> guard(print_mutex);
+            std::cout << "saved " << path << std::endl;
+        });
+
+        delete integrator;
+        return 0;
+    }
+
+    if (stream){
+        ExrTileSink sink;
+        if (!sink.open(config.output_file, config)){
+            std::cout << "could not write " << config.output_file << std::endl;
+            delete integrator;
+            return 1;
+        }
+        std::cout << "rendering, streaming tiles to " << config.output_file << std::endl;
+        render_streamed(*integrator, scene, config, sink);
+
+        delete integrator;
+        if (!sink.close()){
+            std::cout << "could not write " << config.output_file << std::endl;
+            return 1;
+        }
+        std::cout << "success" << std::endl;
+        return 0;
+    }
+
+    Film film(config.width, config.height);
+    if (config.needs_film_aovs()){
+        film.enable_aovs();
+    }
+
+    if (cli.get<bool>("--resume")){
+        if (config.checkpoint_file.empty()){
+            std::cout << "--resume needs a --checkpoint file" << std::endl;
+            return 1;
+        }
+        if (!std::ifstream(config.checkpoint_file)){
+            std::cout << "no checkpoint found, starting from scratch" << std::endl;
+        } else if (!load_checkpoint(config.checkpoint_file, film, config.resume_spp) || film.width != config.width || film.height != config.height){
+            std::cout << "invalid checkpoint or resolution mismatch: " << config.checkpoint_file << std::endl;
+            return 1;
+        } else {
+            std::cout << "resuming from " << config.resume_spp << "spp" << std::endl;
+            if (config.needs_film_aovs() && !film.has_aovs){
+                film.enable_aovs();
+            }
+        }
+    }
    
     ProgressBar progress_bar;
     progress_bar.begin();
 
     std::cout << "rendering" <<std::endl;
 
-    render_tiled(integrator, scene, config, accumulator);
+    //8 bit output is tonemapped tile by tile while the rest of the frame renders
+    std::vector<unsigned char> rgba;
+    if (!partial && !config.denoise && writes_rgba8(config.output_file)){
+        rgba.resize(config.width * config.height * 4);
+    }
+    render_tiled(*integrator, scene, config, film, rgba.empty() ? nullptr : rgba.data());
 
  
     progress_bar.update(1.0);
     progress_bar.display();
+    std::cout << std::endl;
 
-    
-    unsigned char* image_output_buffer = new unsigned char[config.width * config.height * 4];
-
-      for (int y = 0; y < config.height; y++){
-        for (int x = 0; x < config.width; x++){
-          
-            int index = y * config.width + x;
-            glm::vec3 pixel = accumulator[index] / (float) config.spp;
-            pixel = pixel / (pixel + glm::vec3(1.f));
-            pixel = glm::clamp(pixel, 0.f, 1.f);
-            pixel = glm::pow(pixel, glm::vec3(1/2.2f));
-            
-            image_output_buffer[index * 4]     = (unsigned char) (pixel.x * 254);
-            image_output_buffer[index * 4 + 1] = (unsigned char) (pixel.y * 254);
-            image_output_buffer[index * 4 + 2] = (unsigned char) (pixel.z * 254);
-            image_output_buffer[index * 4 + 3] = (unsigned char) (255);
-        }
+    if (TextureCache::global().enabled()){
+        TextureCache& cache = TextureCache::global();
+        std::cout << "texture cache: " << cache.loads << " tile loads, " << cache.evictions << " evictions, "
+                  << cache.used / (1024 * 1024) << " MB resident" << std::endl;
+    }
+    if (config.adaptive_threshold > 0.f || config.progressive || config.resume_spp > 0){
+        std::cout << "average spp: " << (double) film.total_samples() / (config.width * config.height) << std::endl;
+    }
+
+    if (partial){
+        std::cout << "saving partial buffer" << std::endl;
+        bool saved = save_checkpoint(config.output_file, film, config.spp);
+        delete integrator;
+        return saved ? 0 : 1;
     }
     
+    if (config.denoise){
+        std::cout << "denoising" << std::endl;
+        denoise_film(film);
+    }
+
     std::cout << "saving" <<std::endl;
-    stbi_write_png(config.output_file.c_str(), config.width, config.height, 4, image_output_buffer, config.width * 4);
+    bool saved = write_film(config.output_file, film, config, rgba.empty() ? nullptr : rgba.data());
 
-    delete[] accumulator;
-    delete[] image_output_buffer;
+    delete integrator;
+    if (!saved){
+        std::cout << "could not write " << config.output_file << std::endl;
+        return 1;
+    }
 
     std::cout << "success" << std::endl;
     
@@ -0,0 +1,167 @@
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "stb/stb_image_write.h"
+
+#include "server/render_server.h"
+#include "core/denoise.h"
+#include "integrator/integrator.h"
+#include "integrator/restir.h"
+#include "util/progress_bar.h"
+
+static bool send_all(int fd, const void* data, size_t size){
+    const char* bytes = (const char*) data;
+    while (size > 0){
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent <= 0){
+            return false;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static void append_bytes(void* context, void* data, int size){
+    std::vector<unsigned char>* out = (std::vector<unsigned char>*) context;
+    out->insert(out->end(), (unsigned char*) data, (unsigned char*) data + size);
+}
+
+bool RenderServer::run(const std::string& socket_path){
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)){
+        std::cout << "socket path too long: " << socket_path << std::endl;
+        return false;
+    }
+    socket_path.copy(address.sun_path, socket_path.size());
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr*) &address, sizeof(address)) < 0 || listen(listen_fd, 16) < 0){
+        std::cout << "could not listen on " << socket_path << std::endl;
+        if (listen_fd >= 0){
+            close(listen_fd);
+        }
+        return false;
+    }
+    std::cout << "listening on " << socket_path << std::endl;
+
+    while (true){
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0){
+            continue;
+        }
+        this->serve_connection(fd);
+        close(fd);
+    }
+}
+
+void RenderServer::serve_connection(int fd){
+    std::string buffer;
+    char chunk[4096];
+
+    while (true){
+        size_t newline = buffer.find('\n');
+        if (newline == std::string::npos){
+            ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+            if (received <= 0){
+                return;
+            }
+            buffer.append(chunk, received);
+            continue;
+        }
+        std::string line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        if (line.find_first_not_of(" \t\r") == std::string::npos){
+            continue;
+        }
+
+        json header;
+        std::vector<unsigned char> image;
+        try {
+            RenderConfig config = this->defaults;
+            double start = currentTimeMilliseconds();
+            image = this->render_job(json::parse(line), config);
+            std::cout << config.scene_file << " " << config.width << "x" << config.height << " " << config.spp << "spp "
+                      << (currentTimeMilliseconds() - start) / 1000.0 << "s" << std::endl;
+            header = {{"status", "ok"}, {"width", config.width}, {"height", config.height}, {"format", "png"}, {"size", image.size()}};
+        } catch (const std::exception& err){
+            header = {{"status", "error"}, {"message", err.what()}};
+            image.clear();
+        }
+
+        std::string response = header.dump() + "\n";
+        if (!send_all(fd, response.data(), response.size()) || !send_all(fd, image.data(), image.size())){
+            return;
+        }
+    }
+}
+
+std::vector<unsigned char> RenderServer::render_job(const json& job, RenderConfig& config){
+    if (!job.contains("scene")){
+        throw std::runtime_error("job has no scene");
+    }
+    config.scene_file = job["scene"].get<std::string>();
+    //options for a single CLI render never carry over to jobs
+    config.checkpoint_file.clear();
+    config.resume_spp = 0;
+    config.progressive = false;
+    config.time_limit = 0.0;
+    config.noise_target = 0.f;
+    config.region_x0 = config.region_y0 = config.region_x1 = config.region_y1 = 0;
+    config.tile_begin = config.tile_end = 0;
+    config.sample_offset = 0;
+    config.width = job.value("width", config.width);
+    config.height = job.value("height", config.height);
+    config.spp = job.value("spp", config.spp);
+    config.integrator = job.value("integrator", config.integrator);
+    if (config.width <= 0 || config.height <= 0 || config.width > 16384 || config.height > 16384){
+        throw std::runtime_error("invalid resolution");
+    }
+    if (config.spp <= 0){
+        throw std::runtime_error("invalid spp");
+    }
+
+    Scene& scene = this->cache.get(config.scene_file);
+    if (job.contains("camera")){
+        scene.camera = Camera::from_json(job["camera"]);
+    }
+    scene.camera.aspect_ratio = float(config.width)/float(config.height);
+
+    std::unique_ptr<Integrator> integrator;
+    if (config.integrator == "restir"){
+        integrator.reset(new RestirPathTracer(job.value("restir_candidates", 32), job.value("restir_spatial", 4), 8));
+    } else {
+        integrator.reset(new NeePathTracer());
+    }
+
+    if (job.contains("tonemap") && !ToneMapping::parse(job["tonemap"].get<std::string>(), config.tonemap.op)){
+        throw std::runtime_error("unknown tonemap");
+    }
+    config.tonemap.exposure = job.value("exposure", config.tonemap.exposure);
+
+    config.denoise = job.value("denoise", config.denoise);
+
+    Film film(config.width, config.height);
+    if (config.needs_film_aovs()){
+        film.enable_aovs();
+    }
+    std::vector<unsigned char> rgba(config.width * config.height * 4);
+    if (config.denoise){
+        render_tiled(*integrator, scene, config, film);
+        denoise_film(film);
+        film_to_rgba8(film, config.tonemap, rgba.data());
+    } else {
+        //tiles are tonemapped as they finish
+        render_tiled(*integrator, scene, config, film, rgba.data());
+    }
+
+    std::vector<unsigned char> png;
+    stbi_write_png_to_func(append_bytes, &png, config.width, config.height, 4, rgba.data(), config.width * 4);
+    return png;
+}
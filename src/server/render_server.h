@@ -0,0 +1,46 @@
+#ifndef RENDER_SERVER_H_
+#define RENDER_SERVER_H_
+
+#include <string>
+#include <vector>
+
+#include "json/json.hpp"
+
+#include "core/render.h"
+#include "server/scene_cache.h"
+
+using json = nlohmann::json;
+
+/*
+Render daemon listening on a Unix domain socket. Scenes stay resident in a
+SceneCache between jobs and every job runs on the shared thread pool.
+
+A client sends one JSON object per line:
+    {"scene": "scenes/room.json", "width": 256, "height": 256, "spp": 16,
+     "camera": {"fov": 30, "position": [0,0,5], "lookat": [0,0,0]},
+     "integrator": "nee", "tonemap": "aces", "exposure": 0.5,
+     "denoise": true}
+Only "scene" is required, the rest default to the server's settings and the
+camera in the scene file. The server answers each job with a JSON header line
+    {"status": "ok", "width": 256, "height": 256, "format": "png", "size": N}
+followed by N bytes of PNG, or with {"status": "error", "message": "..."}
+and no payload. Jobs on a connection are handled in order until the client
+closes it.
+*/
+class RenderServer {
+    public:
+        RenderConfig defaults;
+        SceneCache cache;
+
+        RenderServer(const RenderConfig& defaults, size_t cache_bytes): defaults(defaults), cache(cache_bytes){}
+
+        //blocks serving connections one at a time, returns false if the socket can't be opened
+        bool run(const std::string& socket_path);
+        //renders a job and returns the encoded image, throws on bad jobs
+        std::vector<unsigned char> render_job(const json& job, RenderConfig& config);
+
+    private:
+        void serve_connection(int fd);
+};
+
+#endif
@@ -0,0 +1,49 @@
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+
+#include "server/scene_cache.h"
+
+SceneCache::~SceneCache(){
+    while (!this->entries.empty()){
+        this->evict(std::prev(this->entries.end()));
+    }
+}
+
+Scene& SceneCache::get(const std::string& path){
+    auto found = this->index.find(path);
+    if (found != this->index.end()){
+        this->entries.splice(this->entries.begin(), this->entries, found->second);
+        Entry& entry = this->entries.front();
+        entry.scene->camera = entry.camera;
+        return *entry.scene;
+    }
+
+    if (!std::ifstream(path)){
+        throw std::runtime_error("could not open scene " + path);
+    }
+    std::unique_ptr<Scene> scene(new Scene(Scene::load_file(path)));
+    scene->build();
+
+    Entry entry;
+    entry.path = path;
+    entry.camera = scene->camera;
+    entry.bytes = scene->memory_usage();
+    entry.scene = std::move(scene);
+    this->used += entry.bytes;
+    this->entries.push_front(std::move(entry));
+    this->index[path] = this->entries.begin();
+
+    while (this->used > this->capacity && this->entries.size() > 1){
+        this->evict(std::prev(this->entries.end()));
+    }
+    return *this->entries.front().scene;
+}
+
+void SceneCache::evict(std::list<Entry>::iterator entry){
+    std::cout << "evicting " << entry->path << " (" << entry->bytes / (1024 * 1024) << " MB)" << std::endl;
+    entry->scene->release_materials();
+    this->used -= entry->bytes;
+    this->index.erase(entry->path);
+    this->entries.erase(entry);
+}
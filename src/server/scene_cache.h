@@ -0,0 +1,46 @@
+#ifndef SCENE_CACHE_H_
+#define SCENE_CACHE_H_
+
+#include <list>
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+#include "core/scene.h"
+#include "core/camera.h"
+
+/*
+Keeps loaded and built scenes resident, keyed by scene file path. Scenes are
+kept in least recently used order and the oldest ones are evicted once their
+estimated memory exceeds the capacity. The scene just requested is never
+evicted, so a single scene larger than the capacity still renders.
+*/
+class SceneCache {
+
+    struct Entry {
+        std::string path;
+        std::unique_ptr<Scene> scene;
+        Camera camera;
+        size_t bytes;
+    };
+
+    public:
+        size_t capacity;
+        size_t used = 0;
+
+        SceneCache(size_t capacity): capacity(capacity){}
+        ~SceneCache();
+
+        //loads and builds the scene on a miss, the camera is reset to the one in the scene file
+        Scene& get(const std::string& path);
+        size_t size() const { return this->entries.size(); }
+
+    private:
+        //front is the most recently used
+        std::list<Entry> entries;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+        void evict(std::list<Entry>::iterator entry);
+};
+
+#endif
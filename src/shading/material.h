@@ -15,7 +15,11 @@ struct BSDFSample {
 class BSDF {
     public:
         bool sample_light;
+        //reflectance and shading normal at the hit, also written to the albedo and normal AOVs
+        glm::vec3 albedo = glm::vec3(1.f);
+        glm::vec3 normal;
         BSDF(){}
+        virtual ~BSDF(){}
         virtual BSDFSample sample(const glm::vec3& wo) = 0;
         virtual glm::vec3 eval(const glm::vec3& wo, const glm::vec3& wi) = 0;
         virtual float pdf(const glm::vec3& wo, const glm::vec3& wi) = 0;
@@ -26,6 +30,7 @@ class Material {
     public:
         bool emmissive = false;
         Material(){}
+        virtual ~Material(){}
         virtual BSDF* create_shader(const IntersectionData& intersection) = 0;
 };
 
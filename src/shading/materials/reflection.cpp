@@ -31,12 +31,12 @@ ReflectionMaterial::ReflectionMaterial() {}
 BSDF* ReflectionMaterial::create_shader(const IntersectionData& intersection) {
     glm::vec3 albedo = this->albedo;
     if (albedo_texture != nullptr) {
-        albedo = albedo_texture->sample(intersection.tex_coord);
+        albedo = albedo_texture->sample(intersection.tex_coord, intersection.duvdx, intersection.duvdy);
     }
 
     glm::vec3 normal = intersection.normal;
     if (normal_texture != nullptr) {
-        glm::vec3 tex_normal = normal_texture->sample(intersection.tex_coord) * 2.0f - 1.0f;
+        glm::vec3 tex_normal = normal_texture->sample(intersection.tex_coord, intersection.duvdx, intersection.duvdy) * 2.0f - 1.0f;
         glm::mat3 tangent_space_to_world = glm::mat3(intersection.tangent, intersection.bitangent, intersection.normal);
         normal = glm::normalize(tangent_space_to_world * tex_normal);
     }
@@ -7,8 +7,6 @@
 
 class ReflectionBSDF : public BSDF {
     public:
-        glm::vec3 albedo;
-        glm::vec3 normal;
         ReflectionBSDF(const glm::vec3 normal, const glm::vec3 albedo);
         BSDFSample sample(const glm::vec3& wo) final;
         glm::vec3 eval(const glm::vec3& wo, const glm::vec3& wi) final;
@@ -19,8 +17,9 @@ class ReflectionBSDF : public BSDF {
 class ReflectionMaterial: public Material {
     public:
         glm::vec3 albedo = glm::vec3(1.0f);
-        TextureMap* albedo_texture = nullptr;
-        TextureMap* normal_texture = nullptr;
+        //shared with other materials using the same image
+        std::shared_ptr<TextureMap> albedo_texture;
+        std::shared_ptr<TextureMap> normal_texture;
         ReflectionMaterial();
         BSDF* create_shader(const IntersectionData& intersection) final;
 };
@@ -3,20 +3,105 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <memory>
+#include <functional>
 #include "glm/glm.hpp"
 
+#include "shading/texture_cache.h"
+
+//storage of one channel of a texel
+enum class TexelFormat { Unorm8, Unorm16, Half };
+
+//color textures are sRGB encoded, data textures (and normal maps) linear
+enum class TextureUsage { Color, Data, Normal };
+
+//order of texels in memory: rows, or 8x8 blocks with z-order (morton) texels inside
+enum class TexelLayout { Scanline, Morton };
+
+//lookup used when a footprint is known: nearest texel of the full image, trilinear or EWA over the mip pyramid
+enum class TextureFilter { Point, Trilinear, Ewa };
+
+/*
+Texture kept in its native texel format: 8 or 16 bit unsigned normalized
+channels, or half floats for HDR images. Texels are decoded to linear float
+when sampled, 8 bit sRGB through a 256 entry table. Color textures keep one
+(grey) or three channels, alpha is dropped since nothing reads it. Normal
+maps keep only x and y, z is reconstructed from them.
+A mip pyramid of 2x2 box filtered levels is built at load time and stored
+after the full image in the same array. Lookups with a uv footprint (from
+ray differentials) pick the levels matching its size, trilinearly or with an
+elliptical weighted average that follows its shape.
+In memory texels are laid out in 8x8 morton blocks by default, so the
+neighbours a bilinear or footprint lookup reads share cache lines in v as
+well as u; scanline order can be chosen at load with default_layout.
+With a TextureCache budget set, textures are converted once to a tiled file
+next to their source (reused while it is newer than the source) and their
+tiles are paged in on demand instead of being held in memory.
+*/
 class TextureMap {
     public:
         int w,h,n;
-        glm::vec3* data;
-        TextureMap(){};
-        ~TextureMap(){
-            delete[] data;
+        TexelFormat format = TexelFormat::Unorm8;
+        bool srgb = false;
+        bool normal_xy = false;
+        TexelLayout layout = TexelLayout::Scanline;
+        std::vector<unsigned char> texels;
+
+        //level 0 is the full image, each one halves the size down to 1x1
+        struct MipLevel {
+            int w, h;
+            size_t offset;
         };
-        glm::vec3 sample(glm::vec2 uv);
-        static TextureMap* load_file(std::string filename);
+        std::vector<MipLevel> levels;
+        //tiles of paged textures, texels is empty then
+        std::unique_ptr<PagedTexture> paged;
+
+        //set once from the command line before rendering
+        static TextureFilter filter;
+        //layout of textures loaded from now on
+        static TexelLayout default_layout;
+
+        TextureMap(){};
+        //nearest texel of the full image
+        glm::vec3 sample(glm::vec2 uv) const;
+        //filtered over the footprint spanned by the uv derivatives, point sampled without one
+        glm::vec3 sample(glm::vec2 uv, glm::vec2 duvdx, glm::vec2 duvdy) const;
+        //decoded texel, x and y wrap around
+        glm::vec3 texel(int x, int y) const { return this->texel(0, x, y); }
+        glm::vec3 texel(int level, int x, int y) const;
+        //resident texels, paged tiles count against the TextureCache budget instead
+        size_t memory_usage() const { return this->texels.size(); }
+
+        static TextureMap* load_file(std::string filename, TextureUsage usage = TextureUsage::Color);
+        //throws std::runtime_error if the file can't be read or decoded
+        static TextureMap* decode_file(const std::string& filename, TextureUsage usage);
+        //encoded image file held in memory, null if it can't be decoded
+        static TextureMap* decode_memory(const unsigned char* bytes, size_t size, TextureUsage usage);
+        //tiled file for source, opened if newer than source, otherwise written from decode()
+        static TextureMap* load_paged(const std::string& tiled_path, const std::string& source, const std::function<TextureMap*()>& decode);
+        static std::string tiled_path(const std::string& source, TextureUsage usage);
+        //pixels hold components values per pixel in the given format
+        static TextureMap* from_pixels(const void* pixels, int w, int h, int components, TexelFormat format, TextureUsage usage);
+        //"point", "trilinear" or "ewa", false for anything else
+        static bool parse_filter(const std::string& name, TextureFilter& filter);
+        //"scanline" or "morton", false for anything else
+        static bool parse_layout(const std::string& name, TexelLayout& layout);
+
+    private:
+        static TextureMap* open_tiled(const std::string& path);
+        //writes the texels to a tiled file and switches to paging from it
+        bool page_out(const std::string& path);
+        //index of the texel's first channel in texels
+        size_t texel_offset(int level, int x, int y) const;
+        const unsigned char* texel_address(int level, int x, int y) const;
+        void allocate_levels();
+        void build_mips();
+        void store(int level, int x, int y, const glm::vec3& value);
+        glm::vec3 bilinear(int level, glm::vec2 uv) const;
+        glm::vec3 ewa(int level, glm::vec2 uv, glm::vec2 d0, glm::vec2 d1) const;
 };
 
 
 
-#endif
\ No newline at end of file
+#endif
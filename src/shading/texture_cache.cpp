@@ -0,0 +1,244 @@
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "shading/texture_cache.h"
+
+static const char tiled_texture_magic[4] = {'R', 'T', 'T', 'X'};
+static const uint32_t tiled_texture_version = 1;
+
+static std::atomic<uint64_t> next_texture_id{1};
+
+template <typename T>
+static void put(std::vector<char>& out, const T& value){
+    out.insert(out.end(), (const char*) &value, (const char*) &value + sizeof(T));
+}
+
+template <typename T>
+static bool get(const std::vector<char>& in, size_t& position, T& value){
+    if (position + sizeof(T) > in.size()){
+        return false;
+    }
+    std::memcpy(&value, in.data() + position, sizeof(T));
+    position += sizeof(T);
+    return true;
+}
+
+bool write_tiled_texture(const std::string& path, int w, int h, int n, int format, bool srgb, bool normal_xy, size_t texel_bytes,
+                         const std::vector<int>& level_w, const std::vector<int>& level_h, const std::vector<const unsigned char*>& level_texels, int tile_size){
+    std::vector<char> header(tiled_texture_magic, tiled_texture_magic + 4);
+    put(header, tiled_texture_version);
+    put(header, (int32_t) w);
+    put(header, (int32_t) h);
+    put(header, (int32_t) n);
+    put(header, (uint8_t) format);
+    put(header, (uint8_t) srgb);
+    put(header, (uint8_t) normal_xy);
+    put(header, (uint8_t) 0);
+    put(header, (int32_t) tile_size);
+    put(header, (int32_t) level_w.size());
+    for (size_t l = 0; l < level_w.size(); l++){
+        put(header, (int32_t) level_w[l]);
+        put(header, (int32_t) level_h[l]);
+    }
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary);
+    if (!file){
+        return false;
+    }
+    file.write(header.data(), header.size());
+
+    std::vector<unsigned char> tile(tile_size * tile_size * texel_bytes);
+    for (size_t l = 0; l < level_w.size(); l++){
+        for (int ty = 0; ty < level_h[l]; ty += tile_size){
+            for (int tx = 0; tx < level_w[l]; tx += tile_size){
+                std::fill(tile.begin(), tile.end(), 0);
+                int rows = std::min(tile_size, level_h[l] - ty);
+                int columns = std::min(tile_size, level_w[l] - tx);
+                for (int y = 0; y < rows; y++){
+                    const unsigned char* row = level_texels[l] + ((size_t) (ty + y) * level_w[l] + tx) * texel_bytes;
+                    std::memcpy(tile.data() + (size_t) y * tile_size * texel_bytes, row, columns * texel_bytes);
+                }
+                file.write((const char*) tile.data(), tile.size());
+            }
+        }
+    }
+    file.close();
+    if (!file){
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+PagedTexture::~PagedTexture(){
+    TextureCache::global().forget(*this);
+    if (this->fd >= 0){
+        close(this->fd);
+    }
+}
+
+bool PagedTexture::open(const std::string& path){
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> header(64);
+    if (!file.read(header.data(), header.size())){
+        return false;
+    }
+    uint32_t version = 0;
+    int32_t w = 0, h = 0, n = 0, tile_size = 0, levels = 0;
+    uint8_t format = 0, srgb = 0, normal_xy = 0, pad = 0;
+    size_t position = 4;
+    if (std::memcmp(header.data(), tiled_texture_magic, 4) != 0 || !get(header, position, version) || version != tiled_texture_version){
+        return false;
+    }
+    if (!get(header, position, w) || !get(header, position, h) || !get(header, position, n) ||
+        !get(header, position, format) || !get(header, position, srgb) || !get(header, position, normal_xy) || !get(header, position, pad) ||
+        !get(header, position, tile_size) || !get(header, position, levels)){
+        return false;
+    }
+    if (w <= 0 || h <= 0 || n <= 0 || n > 3 || tile_size <= 0 || levels <= 0 || levels > 32){
+        return false;
+    }
+
+    header.resize(position + levels * 8);
+    file.seekg(position);
+    if (!file.read(header.data() + position, levels * 8)){
+        return false;
+    }
+    this->w = w;
+    this->h = h;
+    this->n = n;
+    this->format = format;
+    this->srgb = srgb;
+    this->normal_xy = normal_xy;
+    this->tile_size = tile_size;
+    this->tile_bytes = (size_t) tile_size * tile_size * n * (format == 0 ? 1 : 2);
+    this->tile_count = 0;
+    for (int l = 0; l < levels; l++){
+        int32_t lw = 0, lh = 0;
+        if (!get(header, position, lw) || !get(header, position, lh) || lw <= 0 || lh <= 0){
+            return false;
+        }
+        //levels halve down from the full size like TextureMap's mip chain
+        int32_t expected_w = l == 0 ? w : std::max(this->level_w.back() / 2, 1);
+        int32_t expected_h = l == 0 ? h : std::max(this->level_h.back() / 2, 1);
+        if (lw != expected_w || lh != expected_h){
+            return false;
+        }
+        int tiles_x = (lw + tile_size - 1) / tile_size;
+        int tiles_y = (lh + tile_size - 1) / tile_size;
+        this->level_w.push_back(lw);
+        this->level_h.push_back(lh);
+        this->level_tiles_x.push_back(tiles_x);
+        this->level_first_tile.push_back(this->tile_count);
+        this->tile_count += tiles_x * tiles_y;
+    }
+    this->data_offset = position;
+
+    //truncated files are rejected so the texture gets decoded again
+    file.clear();
+    file.seekg(0, std::ios::end);
+    std::streamoff file_size = file.tellg();
+    if (file_size < 0 || (uint64_t) file_size < this->data_offset + (uint64_t) this->tile_count * this->tile_bytes){
+        return false;
+    }
+
+    this->fd = ::open(path.c_str(), O_RDONLY);
+    if (this->fd < 0){
+        return false;
+    }
+    this->slots.reset(new std::shared_ptr<TextureTile>[this->tile_count]);
+    this->id = next_texture_id++;
+    return true;
+}
+
+int PagedTexture::tile_index(int level, int x, int y) const {
+    return this->level_first_tile[level] + (y / this->tile_size) * this->level_tiles_x[level] + x / this->tile_size;
+}
+
+std::shared_ptr<TextureTile> PagedTexture::tile(int level, int x, int y){
+    int index = this->tile_index(level, x, y);
+    std::shared_ptr<TextureTile> tile = std::atomic_load(&this->slots[index]);
+    if (!tile){
+        tile = TextureCache::global().load(*this, index);
+    }
+    tile->used.store(true, std::memory_order_relaxed);
+    return tile;
+}
+
+std::shared_ptr<TextureTile> PagedTexture::read_tile(int index) const {
+    std::shared_ptr<TextureTile> tile = std::make_shared<TextureTile>();
+    tile->texels.resize(this->tile_bytes);
+    off_t offset = this->data_offset + (off_t) index * this->tile_bytes;
+    size_t done = 0;
+    while (done < this->tile_bytes){
+        ssize_t got = pread(this->fd, tile->texels.data() + done, this->tile_bytes - done, offset + done);
+        if (got <= 0){
+            //a truncated file reads as black rather than failing mid render
+            break;
+        }
+        done += got;
+    }
+    return tile;
+}
+
+TextureCache& TextureCache::global(){
+    static TextureCache cache;
+    return cache;
+}
+
+std::shared_ptr<TextureTile> TextureCache::load(PagedTexture& texture, int index){
+    std::shared_ptr<TextureTile> tile = texture.read_tile(index);
+
+    std::lock_guard<std::mutex> guard(this->mutex);
+    //another thread may have loaded it meanwhile
+    std::shared_ptr<TextureTile> existing = std::atomic_load(&texture.slots[index]);
+    if (existing){
+        return existing;
+    }
+    std::atomic_store(&texture.slots[index], tile);
+    this->resident.push_back({&texture, index});
+    this->used += texture.tile_bytes;
+    this->loads++;
+    this->evict();
+    return tile;
+}
+
+void TextureCache::evict(){
+    //the tile just loaded is last and still marked used, so it survives the sweep
+    while (this->used > this->budget && this->resident.size() > 1){
+        if (this->hand >= this->resident.size()){
+            this->hand = 0;
+        }
+        Resident entry = this->resident[this->hand];
+        std::shared_ptr<TextureTile>& slot = entry.texture->slots[entry.index];
+        std::shared_ptr<TextureTile> tile = std::atomic_load(&slot);
+        if (tile->used.exchange(false, std::memory_order_relaxed)){
+            this->hand++;
+            continue;
+        }
+        std::atomic_store(&slot, std::shared_ptr<TextureTile>());
+        this->used -= entry.texture->tile_bytes;
+        this->evictions++;
+        this->resident[this->hand] = this->resident.back();
+        this->resident.pop_back();
+    }
+}
+
+void TextureCache::forget(PagedTexture& texture){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    for (size_t i = 0; i < this->resident.size();){
+        if (this->resident[i].texture == &texture){
+            this->used -= texture.tile_bytes;
+            this->resident[i] = this->resident.back();
+            this->resident.pop_back();
+        } else {
+            i++;
+        }
+    }
+    this->hand = 0;
+}
@@ -0,0 +1,95 @@
+#ifndef TEXTURE_CACHE_H_
+#define TEXTURE_CACHE_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+//texels of one tile, row stride tile_size
+struct TextureTile {
+    std::vector<unsigned char> texels;
+    //reference bit for the clock eviction, set on every lookup
+    std::atomic<bool> used{true};
+};
+
+/*
+Texture stored as fixed size tiles of every mip level in a tiled texture
+file (.rttex) and read from it on first access. Tile slots are published
+with atomic shared_ptr stores, so lookups of resident tiles take no lock;
+a tile evicted while a thread still samples it stays alive until released.
+*/
+class PagedTexture {
+    public:
+        int tile_size = 0;
+        size_t tile_bytes = 0;
+        //unique over the program's lifetime, identifies the texture in per thread caches
+        uint64_t id = 0;
+
+        ~PagedTexture();
+        //false if path is not a readable tiled texture
+        bool open(const std::string& path);
+        //tile holding texel (x, y) of the level, loaded if needed
+        std::shared_ptr<TextureTile> tile(int level, int x, int y);
+        int tile_index(int level, int x, int y) const;
+
+        //image description read from the file header
+        int w = 0, h = 0, n = 0, format = 0;
+        bool srgb = false, normal_xy = false;
+        std::vector<int> level_w, level_h;
+
+    private:
+        int fd = -1;
+        std::vector<int> level_tiles_x, level_first_tile;
+        size_t data_offset = 0;
+        std::unique_ptr<std::shared_ptr<TextureTile>[]> slots;
+        int tile_count = 0;
+
+        std::shared_ptr<TextureTile> read_tile(int index) const;
+        friend class TextureCache;
+};
+
+/*
+Shared memory budget of all paged textures. Loaded tiles beyond the budget
+evict others picked by a clock sweep over the resident tiles (an LRU
+approximation that needs no bookkeeping on hits). Misses and evictions
+serialize on one mutex, file reads happen outside it.
+*/
+class TextureCache {
+    public:
+        //0 keeps textures fully in memory
+        size_t budget = 0;
+        std::atomic<size_t> used{0};
+        std::atomic<size_t> loads{0};
+        std::atomic<size_t> evictions{0};
+
+        static TextureCache& global();
+        bool enabled() const { return this->budget > 0; }
+        std::shared_ptr<TextureTile> load(PagedTexture& texture, int index);
+        //drops the texture's tiles from the resident list, called before it is destroyed
+        void forget(PagedTexture& texture);
+
+    private:
+        std::mutex mutex;
+        struct Resident {
+            PagedTexture* texture;
+            int index;
+        };
+        std::vector<Resident> resident;
+        size_t hand = 0;
+
+        void evict();
+};
+
+/*
+Writes a tiled texture file: a header describing the image and its mip
+levels, then for every level its tiles in row order, each tile_size^2
+texels (edge tiles padded), so tile offsets follow from the header.
+level_texels[l] points to level l's texels in scanline order.
+*/
+bool write_tiled_texture(const std::string& path, int w, int h, int n, int format, bool srgb, bool normal_xy, size_t texel_bytes,
+                         const std::vector<int>& level_w, const std::vector<int>& level_h, const std::vector<const unsigned char*>& level_texels, int tile_size);
+
+#endif
@@ -0,0 +1,43 @@
+#include <climits>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "shading/texture_loader.h"
+
+std::string TextureLoader::canonical_path(const std::string& path){
+    char resolved[PATH_MAX];
+    return realpath(path.c_str(), resolved) != nullptr ? std::string(resolved) : path;
+}
+
+std::shared_ptr<TextureMap> TextureLoader::load_file(const std::string& path, TextureUsage usage){
+    return this->load(canonical_path(path), usage, [path, usage](){
+        return TextureMap::load_file(path, usage);
+    });
+}
+
+std::shared_ptr<TextureMap> TextureLoader::load(const std::string& key, TextureUsage usage, std::function<TextureMap*()> decode){
+    //the same file can be both a color and a normal map
+    std::string usage_key = key + (usage == TextureUsage::Normal ? "#normal" : usage == TextureUsage::Data ? "#data" : "#color");
+    std::shared_ptr<TextureMap> texture;
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        std::shared_ptr<TextureMap>& slot = this->textures[usage_key];
+        if (slot){
+            return slot;
+        }
+        slot = texture = std::make_shared<TextureMap>();
+    }
+    this->group.run([texture, decode, key](){
+        std::unique_ptr<TextureMap> decoded(decode());
+        if (!decoded){
+            throw std::runtime_error("failed to load texture " + key);
+        }
+        *texture = std::move(*decoded);
+    });
+    return texture;
+}
+
+size_t TextureLoader::size(){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    return this->textures.size();
+}
@@ -0,0 +1,40 @@
+#ifndef TEXTURE_LOADER_H_
+#define TEXTURE_LOADER_H_
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+
+#include "shading/texture.h"
+#include "util/thread_pool.h"
+
+/*
+Decodes the textures of a scene as tasks on the thread pool, so they load
+alongside mesh parsing and the BVH build instead of one after another.
+Requests for an image already requested (by path and usage) return the same
+texture, which materials share. Returned textures are empty until their
+decode finishes, wait() must return before they are sampled.
+*/
+class TextureLoader {
+    public:
+        TextureLoader(ThreadPool& pool): group(pool){}
+
+        std::shared_ptr<TextureMap> load_file(const std::string& path, TextureUsage usage = TextureUsage::Color);
+        //key names the image, decode runs on the pool the first time a key is requested
+        std::shared_ptr<TextureMap> load(const std::string& key, TextureUsage usage, std::function<TextureMap*()> decode);
+        //rethrows the first decode error
+        void wait(){ this->group.wait(); }
+        //distinct textures requested so far
+        size_t size();
+        //absolute path without . / .. or links, path itself if it doesn't exist
+        static std::string canonical_path(const std::string& path);
+
+    private:
+        TaskGroup group;
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<TextureMap>> textures;
+};
+
+#endif
@@ -1,33 +1,502 @@
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
 
+#include <sys/stat.h>
 
 #include "stb/stb_image.h"
+#include "glm/gtc/packing.hpp"
 #include "shading/texture.h"
+#include "shading/texture_cache.h"
 
-glm::vec3 TextureMap::sample(glm::vec2 uv){
-    int x = uv.x * w;
-    int y = (1.0f - uv.y) * h;
-    int idx = y * w + x;
-    return data[idx];
+//edge length of the tiles paged textures are stored in
+static const int texture_tile_size = 64;
+
+static float srgb_to_linear(float v){
+    return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
 }
 
+//decoded value of every 8 bit code, linear and sRGB
+struct Unorm8Table {
+    float linear[256];
+    float srgb[256];
+    Unorm8Table(){
+        for (int i = 0; i < 256; i++){
+            this->linear[i] = i / 255.f;
+            this->srgb[i] = srgb_to_linear(i / 255.f);
+        }
+    }
+};
 
-TextureMap* TextureMap::load_file(std::string filename) {
-    TextureMap* map = new TextureMap;
-    int w,h,n;
-    unsigned char* data = stbi_load(filename.c_str(), &w, &h, &n, 0);
-    if(data == NULL) {
-        std::cerr << "Failed to load texture file: " << filename << std::endl;
-        std::exit(1);
+static const Unorm8Table& unorm8_table(){
+    static const Unorm8Table table;
+    return table;
+}
+
+//16 bit sRGB is rare enough that its table is only built when first needed
+static const std::vector<float>& srgb16_table(){
+    static const std::vector<float> table = [](){
+        std::vector<float> values(65536);
+        for (int i = 0; i < 65536; i++){
+            values[i] = srgb_to_linear(i / 65535.f);
+        }
+        return values;
+    }();
+    return table;
+}
+
+static size_t texel_format_size(TexelFormat format){
+    return format == TexelFormat::Unorm8 ? 1 : 2;
+}
+
+static float linear_to_srgb(float v){
+    return v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.f / 2.4f) - 0.055f;
+}
+
+TextureFilter TextureMap::filter = TextureFilter::Trilinear;
+TexelLayout TextureMap::default_layout = TexelLayout::Morton;
+
+bool TextureMap::parse_filter(const std::string& name, TextureFilter& filter){
+    if (name == "point"){
+        filter = TextureFilter::Point;
+    } else if (name == "trilinear"){
+        filter = TextureFilter::Trilinear;
+    } else if (name == "ewa"){
+        filter = TextureFilter::Ewa;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+//last tile each thread sampled, saves the slot lookup for runs of texels in one tile
+struct LastTile {
+    uint64_t texture = 0;
+    int index = -1;
+    std::shared_ptr<TextureTile> tile;
+};
+static thread_local LastTile last_tile;
+
+//bits of a 3 bit coordinate spread to every other bit
+static const uint8_t morton_spread[8] = {0, 1, 4, 5, 16, 17, 20, 21};
+
+size_t TextureMap::texel_offset(int level, int x, int y) const {
+    const MipLevel& mip = this->levels[level];
+    if (this->layout == TexelLayout::Morton){
+        //8x8 blocks in row order, z-order inside a block
+        size_t block = (size_t) (y >> 3) * ((mip.w + 7) >> 3) + (x >> 3);
+        size_t inner = morton_spread[x & 7] | (morton_spread[y & 7] << 1);
+        return mip.offset + ((block << 6) | inner) * this->n;
+    }
+    return mip.offset + ((size_t) y * mip.w + x) * this->n;
+}
+
+const unsigned char* TextureMap::texel_address(int level, int x, int y) const {
+    if (!this->paged){
+        return this->texels.data() + this->texel_offset(level, x, y) * texel_format_size(this->format);
+    }
+    PagedTexture& paged = *this->paged;
+    int index = paged.tile_index(level, x, y);
+    if (last_tile.texture != paged.id || last_tile.index != index){
+        last_tile.tile = paged.tile(level, x, y);
+        last_tile.texture = paged.id;
+        last_tile.index = index;
+    }
+    int tile_size = paged.tile_size;
+    return last_tile.tile->texels.data() + ((size_t) (y % tile_size) * tile_size + x % tile_size) * this->n * texel_format_size(this->format);
+}
+
+bool TextureMap::parse_layout(const std::string& name, TexelLayout& layout){
+    if (name == "scanline"){
+        layout = TexelLayout::Scanline;
+    } else if (name == "morton"){
+        layout = TexelLayout::Morton;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+glm::vec3 TextureMap::texel(int level, int x, int y) const {
+    const MipLevel& mip = this->levels[level];
+    x %= mip.w;
+    y %= mip.h;
+    x += x < 0 ? mip.w : 0;
+    y += y < 0 ? mip.h : 0;
+    const unsigned char* address = this->texel_address(level, x, y);
+
+    float v[3] = {0.f, 0.f, 0.f};
+    switch (this->format){
+        case TexelFormat::Unorm8: {
+            const float* table = this->srgb ? unorm8_table().srgb : unorm8_table().linear;
+            for (int c = 0; c < this->n; c++){
+                v[c] = table[address[c]];
+            }
+            break;
+        }
+        case TexelFormat::Unorm16: {
+            const uint16_t* values = (const uint16_t*) address;
+            for (int c = 0; c < this->n; c++){
+                v[c] = this->srgb ? srgb16_table()[values[c]] : values[c] / 65535.f;
+            }
+            break;
+        }
+        case TexelFormat::Half: {
+            const uint16_t* values = (const uint16_t*) address;
+            for (int c = 0; c < this->n; c++){
+                v[c] = glm::unpackHalf1x16(values[c]);
+            }
+            break;
+        }
+    }
+
+    if (this->normal_xy){
+        //back to the [0, 1] encoding normal map users expect
+        float nx = v[0] * 2.f - 1.f;
+        float ny = v[1] * 2.f - 1.f;
+        float nz = std::sqrt(std::max(1.f - nx * nx - ny * ny, 0.f));
+        return glm::vec3(v[0], v[1], nz * 0.5f + 0.5f);
+    }
+    if (this->n == 1){
+        return glm::vec3(v[0]);
+    }
+    return glm::vec3(v[0], v[1], v[2]);
+}
+
+//encodes a decoded texel into the texture's format
+void TextureMap::store(int level, int x, int y, const glm::vec3& value){
+    size_t index = this->texel_offset(level, x, y);
+    for (int c = 0; c < this->n; c++){
+        float v = value[c];
+        switch (this->format){
+            case TexelFormat::Unorm8:
+                v = glm::clamp(this->srgb ? linear_to_srgb(v) : v, 0.f, 1.f);
+                this->texels[index + c] = (unsigned char) (v * 255.f + 0.5f);
+                break;
+            case TexelFormat::Unorm16: {
+                v = glm::clamp(this->srgb ? linear_to_srgb(v) : v, 0.f, 1.f);
+                uint16_t u = (uint16_t) (v * 65535.f + 0.5f);
+                std::memcpy(&this->texels[(index + c) * 2], &u, 2);
+                break;
+            }
+            case TexelFormat::Half: {
+                uint16_t h = glm::packHalf1x16(v);
+                std::memcpy(&this->texels[(index + c) * 2], &h, 2);
+                break;
+            }
+        }
+    }
+}
+
+//texels a level occupies, morton levels are padded to whole blocks
+static size_t level_storage(TexelLayout layout, int w, int h){
+    if (layout == TexelLayout::Morton){
+        return (size_t) ((w + 7) & ~7) * ((h + 7) & ~7);
+    }
+    return (size_t) w * h;
+}
+
+void TextureMap::allocate_levels(){
+    size_t texel_size = this->n * texel_format_size(this->format);
+    this->levels = {{this->w, this->h, 0}};
+    size_t size = level_storage(this->layout, this->w, this->h);
+    while (this->levels.back().w > 1 || this->levels.back().h > 1){
+        const MipLevel& last = this->levels.back();
+        MipLevel level = {std::max(last.w / 2, 1), std::max(last.h / 2, 1), size * this->n};
+        size += level_storage(this->layout, level.w, level.h);
+        this->levels.push_back(level);
+    }
+    this->texels.assign(size * texel_size, 0);
+}
+
+void TextureMap::build_mips(){
+    //averages are taken on decoded linear values
+    for (size_t l = 1; l < this->levels.size(); l++){
+        const MipLevel& parent = this->levels[l - 1];
+        const MipLevel& level = this->levels[l];
+        int sx = parent.w > 1 ? 2 : 1;
+        int sy = parent.h > 1 ? 2 : 1;
+        for (int y = 0; y < level.h; y++){
+            for (int x = 0; x < level.w; x++){
+                glm::vec3 sum(0.f);
+                for (int dy = 0; dy < sy; dy++){
+                    for (int dx = 0; dx < sx; dx++){
+                        sum += this->texel(l - 1, x * sx + dx, y * sy + dy);
+                    }
+                }
+                this->store(l, x, y, sum / (float) (sx * sy));
+            }
+        }
+    }
+}
+
+glm::vec3 TextureMap::bilinear(int level, glm::vec2 uv) const {
+    const MipLevel& mip = this->levels[level];
+    float s = uv.x * mip.w - 0.5f;
+    float t = (1.0f - uv.y) * mip.h - 0.5f;
+    int x = (int) std::floor(s);
+    int y = (int) std::floor(t);
+    float fx = s - x;
+    float fy = t - y;
+    return (1.f - fx) * (1.f - fy) * this->texel(level, x, y) + fx * (1.f - fy) * this->texel(level, x + 1, y) +
+           (1.f - fx) * fy * this->texel(level, x, y + 1) + fx * fy * this->texel(level, x + 1, y + 1);
+}
+
+//elliptical weighted average with a gaussian falloff, d0 and d1 are the footprint axes in level 0 texels
+glm::vec3 TextureMap::ewa(int level, glm::vec2 uv, glm::vec2 d0, glm::vec2 d1) const {
+    if (level >= (int) this->levels.size() - 1){
+        return this->texel((int) this->levels.size() - 1, 0, 0);
+    }
+    const MipLevel& mip = this->levels[level];
+    glm::vec2 scale((float) mip.w / this->w, (float) mip.h / this->h);
+    d0 *= scale;
+    d1 *= scale;
+    float s = uv.x * mip.w - 0.5f;
+    float t = (1.0f - uv.y) * mip.h - 0.5f;
+
+    //implicit ellipse A s^2 + B s t + C t^2 = 1, widened by a texel so it never falls between texels
+    float a = d0.y * d0.y + d1.y * d1.y + 1.f;
+    float b = -2.f * (d0.x * d0.y + d1.x * d1.y);
+    float c = d0.x * d0.x + d1.x * d1.x + 1.f;
+    float inv_f = 1.f / (a * c - b * b * 0.25f);
+    a *= inv_f;
+    b *= inv_f;
+    c *= inv_f;
+
+    float det = -b * b + 4.f * a * c;
+    float inv_det = 1.f / det;
+    float u_extent = 2.f * inv_det * std::sqrt(det * c);
+    float v_extent = 2.f * inv_det * std::sqrt(det * a);
+    int s0 = (int) std::ceil(s - u_extent);
+    int s1 = (int) std::floor(s + u_extent);
+    int t0 = (int) std::ceil(t - v_extent);
+    int t1 = (int) std::floor(t + v_extent);
+
+    glm::vec3 sum(0.f);
+    float sum_weight = 0.f;
+    for (int it = t0; it <= t1; it++){
+        float tt = it - t;
+        for (int is = s0; is <= s1; is++){
+            float ss = is - s;
+            float r2 = a * ss * ss + b * ss * tt + c * tt * tt;
+            if (r2 < 1.f){
+                float weight = std::exp(-2.f * r2) - std::exp(-2.f);
+                sum += weight * this->texel(level, is, it);
+                sum_weight += weight;
+            }
+        }
     }
+    return sum_weight > 0.f ? sum / sum_weight : this->bilinear(level, uv);
+}
+
+glm::vec3 TextureMap::sample(glm::vec2 uv) const {
+    int x = (int) std::floor(uv.x * w);
+    int y = (int) std::floor((1.0f - uv.y) * h);
+    return this->texel(x, y);
+}
+
+glm::vec3 TextureMap::sample(glm::vec2 uv, glm::vec2 duvdx, glm::vec2 duvdy) const {
+    if (TextureMap::filter == TextureFilter::Point || (duvdx == glm::vec2(0.f) && duvdy == glm::vec2(0.f))){
+        return this->sample(uv);
+    }
+    glm::vec2 size((float) this->w, (float) this->h);
+    glm::vec2 d0 = duvdx * size;
+    glm::vec2 d1 = duvdy * size;
+    int last = (int) this->levels.size() - 1;
+
+    float width;
+    if (TextureMap::filter == TextureFilter::Trilinear){
+        width = std::max(std::max(std::abs(d0.x), std::abs(d0.y)), std::max(std::abs(d1.x), std::abs(d1.y)));
+    } else {
+        //the minor axis picks the level, very thin ellipses are widened to bound the texels visited
+        if (glm::dot(d0, d0) < glm::dot(d1, d1)){
+            std::swap(d0, d1);
+        }
+        float major = glm::length(d0);
+        float minor = glm::length(d1);
+        const float max_anisotropy = 8.f;
+        if (minor * max_anisotropy < major && minor > 0.f){
+            d1 *= major / (minor * max_anisotropy);
+            minor = major / max_anisotropy;
+        }
+        width = minor;
+    }
+
+    float lod = std::max(std::log2(std::max(width, 1e-8f)), 0.f);
+    int level = std::min((int) lod, last);
+    float f = lod - level;
+    if (level == last){
+        return this->texel(last, 0, 0);
+    }
+    if (TextureMap::filter == TextureFilter::Trilinear){
+        return glm::mix(this->bilinear(level, uv), this->bilinear(level + 1, uv), f);
+    }
+    return glm::mix(this->ewa(level, uv, d0, d1), this->ewa(level + 1, uv, d0, d1), f);
+}
+
+TextureMap* TextureMap::from_pixels(const void* pixels, int w, int h, int components, TexelFormat format, TextureUsage usage){
+    TextureMap* map = new TextureMap;
     map->w = w;
     map->h = h;
-    map->n = n;
-    map->data = new glm::vec3[w*h];
-    for(int i=0; i<w*h; i++) {
-        glm::vec3 color =  glm::vec3(data[i*n+0]/254.0f, data[i*n+1]/254.0f, data[i*n+2]/254.0f);
-        color = glm::pow(color, glm::vec3(2.2f)); // linear space
-        map->data[i] = color;
+    map->format = format;
+    map->srgb = usage == TextureUsage::Color && format != TexelFormat::Half;
+    map->normal_xy = usage == TextureUsage::Normal && components >= 3;
+
+    //source channels kept, grey + alpha and alpha itself are dropped
+    int kept = components >= 3 ? 3 : 1;
+    if (map->normal_xy){
+        kept = 2;
+    }
+    map->n = kept;
+
+    map->layout = TextureMap::default_layout;
+    map->allocate_levels();
+
+    size_t size = texel_format_size(format);
+    const unsigned char* in = (const unsigned char*) pixels;
+    unsigned char* out = map->texels.data();
+    for (int y = 0; y < h; y++){
+        for (int x = 0; x < w; x++){
+            std::memcpy(out + map->texel_offset(0, x, y) * size, in + ((size_t) y * w + x) * components * size, kept * size);
+        }
+    }
+    map->build_mips();
+    return map;
+}
+
+static bool newer_than(const std::string& path, const std::string& source){
+    struct stat path_stat, source_stat;
+    if (stat(path.c_str(), &path_stat) != 0 || stat(source.c_str(), &source_stat) != 0){
+        return false;
+    }
+    return path_stat.st_mtime >= source_stat.st_mtime;
+}
+
+TextureMap* TextureMap::open_tiled(const std::string& path){
+    std::unique_ptr<PagedTexture> paged(new PagedTexture());
+    if (!paged->open(path)){
+        return nullptr;
+    }
+    TextureMap* map = new TextureMap;
+    map->w = paged->w;
+    map->h = paged->h;
+    map->n = paged->n;
+    map->format = (TexelFormat) paged->format;
+    map->srgb = paged->srgb;
+    map->normal_xy = paged->normal_xy;
+    map->layout = TexelLayout::Scanline;
+    for (size_t l = 0; l < paged->level_w.size(); l++){
+        map->levels.push_back({paged->level_w[l], paged->level_h[l], 0});
+    }
+    map->paged = std::move(paged);
+    return map;
+}
+
+bool TextureMap::page_out(const std::string& path){
+    size_t texel_bytes = this->n * texel_format_size(this->format);
+    std::vector<int> level_w, level_h;
+    std::vector<const unsigned char*> level_texels;
+    //tiled files take scanline levels
+    std::vector<std::vector<unsigned char>> scanline(this->levels.size());
+    for (size_t l = 0; l < this->levels.size(); l++){
+        const MipLevel& level = this->levels[l];
+        level_w.push_back(level.w);
+        level_h.push_back(level.h);
+        if (this->layout == TexelLayout::Scanline){
+            level_texels.push_back(this->texels.data() + level.offset * texel_format_size(this->format));
+            continue;
+        }
+        scanline[l].resize((size_t) level.w * level.h * texel_bytes);
+        for (int y = 0; y < level.h; y++){
+            for (int x = 0; x < level.w; x++){
+                std::memcpy(&scanline[l][((size_t) y * level.w + x) * texel_bytes], this->texel_address(l, x, y), texel_bytes);
+            }
+        }
+        level_texels.push_back(scanline[l].data());
+    }
+    if (!write_tiled_texture(path, this->w, this->h, this->n, (int) this->format, this->srgb, this->normal_xy, texel_bytes,
+                             level_w, level_h, level_texels, texture_tile_size)){
+        return false;
+    }
+    std::unique_ptr<PagedTexture> paged(new PagedTexture());
+    if (!paged->open(path)){
+        return false;
+    }
+    this->paged = std::move(paged);
+    std::vector<unsigned char>().swap(this->texels);
+    return true;
+}
+
+TextureMap* TextureMap::load_paged(const std::string& tiled_path, const std::string& source, const std::function<TextureMap*()>& decode){
+    if (newer_than(tiled_path, source)){
+        if (TextureMap* map = open_tiled(tiled_path)){
+            return map;
+        }
+    }
+    TextureMap* map = decode();
+    if (map == nullptr){
+        return nullptr;
+    }
+    if (!map->page_out(tiled_path)){
+        std::cerr << "could not write tiled texture " << tiled_path << ", keeping it in memory" << std::endl;
+    }
+    return map;
+}
+
+std::string TextureMap::tiled_path(const std::string& source, TextureUsage usage){
+    return source + (usage == TextureUsage::Normal ? ".normal" : usage == TextureUsage::Data ? ".data" : "") + ".rttex";
+}
+
+TextureMap* TextureMap::load_file(std::string filename, TextureUsage usage) {
+    if (TextureCache::global().enabled()){
+        return load_paged(tiled_path(filename, usage), filename, [&](){
+            return TextureMap::decode_file(filename, usage);
+        });
+    }
+    return TextureMap::decode_file(filename, usage);
+}
+
+TextureMap* TextureMap::decode_file(const std::string& filename, TextureUsage usage) {
+    std::ifstream file(filename, std::ios::binary);
+    std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    TextureMap* map = bytes.empty() ? nullptr : decode_memory(bytes.data(), bytes.size(), usage);
+    if (map == nullptr) {
+        throw std::runtime_error("failed to load texture file " + filename);
+    }
+    return map;
+}
+
+TextureMap* TextureMap::decode_memory(const unsigned char* bytes, size_t size, TextureUsage usage) {
+    int w,h,n;
+    void* data;
+    TexelFormat format;
+    std::vector<uint16_t> halfs;
+    if (stbi_is_hdr_from_memory(bytes, size)){
+        float* values = stbi_loadf_from_memory(bytes, size, &w, &h, &n, 0);
+        data = values;
+        format = TexelFormat::Half;
+        if (values != NULL){
+            halfs.resize((size_t) w * h * n);
+            for (size_t i = 0; i < halfs.size(); i++){
+                halfs[i] = glm::packHalf1x16(values[i]);
+            }
+        }
+    } else if (stbi_is_16_bit_from_memory(bytes, size)){
+        data = stbi_load_16_from_memory(bytes, size, &w, &h, &n, 0);
+        format = TexelFormat::Unorm16;
+    } else {
+        data = stbi_load_from_memory(bytes, size, &w, &h, &n, 0);
+        format = TexelFormat::Unorm8;
+    }
+    if(data == NULL) {
+        return nullptr;
     }
+    TextureMap* map = from_pixels(halfs.empty() ? data : halfs.data(), w, h, n, format, usage);
     stbi_image_free(data);
     return map;
 }
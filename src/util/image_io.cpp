@@ -0,0 +1,262 @@
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "glm/gtc/packing.hpp"
+
+#include "util/image_io.h"
+#include "util/thread_pool.h"
+
+//zlib stream compressor from stb_image_write, used for the png writer too
+extern "C" unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+
+template <typename T>
+static void put(std::vector<char>& out, const T& value){
+    out.insert(out.end(), (const char*) &value, (const char*) &value + sizeof(T));
+}
+
+static void put_string(std::vector<char>& out, const std::string& s){
+    out.insert(out.end(), s.begin(), s.end());
+    out.push_back('\0');
+}
+
+static void put_attribute(std::vector<char>& out, const std::string& name, const std::string& type, const std::vector<char>& value){
+    put_string(out, name);
+    put_string(out, type);
+    put(out, (int32_t) value.size());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+//byte interleaving and delta predictor applied by OpenEXR before zlib
+static std::vector<unsigned char> zip_block(const std::vector<unsigned char>& raw){
+    size_t n = raw.size();
+    std::vector<unsigned char> tmp(n);
+    size_t half = (n + 1) / 2;
+    for (size_t i = 0; i < n; i++){
+        tmp[(i % 2 == 0) ? i / 2 : half + i / 2] = raw[i];
+    }
+    int p = n > 0 ? tmp[0] : 0;
+    for (size_t i = 1; i < n; i++){
+        int d = int(tmp[i]) - p + (128 + 256);
+        p = tmp[i];
+        tmp[i] = (unsigned char) d;
+    }
+
+    int length = 0;
+    unsigned char* compressed = stbi_zlib_compress(tmp.data(), (int) n, &length, 6);
+    std::vector<unsigned char> result;
+    //blocks that don't shrink are stored raw
+    if (compressed == nullptr || (size_t) length >= n){
+        result = raw;
+    } else {
+        result.assign(compressed, compressed + length);
+    }
+    std::free(compressed);
+    return result;
+}
+
+//header of a single part scanline image, or a tiled one when tile_size > 0
+static std::vector<char> exr_header(int width, int height, const std::vector<std::string>& channel_names, bool half, ExrCompression compression, int tile_size){
+    std::vector<char> header;
+    put(header, (uint32_t) 20000630);
+    put(header, (uint32_t) (tile_size > 0 ? 0x202 : 2));
+
+    std::vector<char> chlist;
+    for (const std::string& name : channel_names){
+        put_string(chlist, name);
+        put(chlist, (int32_t) (half ? 1 : 2));
+        put(chlist, (uint32_t) 0);
+        put(chlist, (int32_t) 1);
+        put(chlist, (int32_t) 1);
+    }
+    chlist.push_back('\0');
+    put_attribute(header, "channels", "chlist", chlist);
+
+    put_attribute(header, "compression", "compression", {(char) (compression == ExrCompression::Zip ? 3 : compression == ExrCompression::Zips ? 2 : 0)});
+
+    std::vector<char> box;
+    put(box, (int32_t) 0);
+    put(box, (int32_t) 0);
+    put(box, (int32_t) (width - 1));
+    put(box, (int32_t) (height - 1));
+    put_attribute(header, "dataWindow", "box2i", box);
+    put_attribute(header, "displayWindow", "box2i", box);
+    //tiles are written in the order they finish
+    put_attribute(header, "lineOrder", "lineOrder", {(char) (tile_size > 0 ? 2 : 0)});
+
+    std::vector<char> value;
+    put(value, 1.f);
+    put_attribute(header, "pixelAspectRatio", "float", value);
+    put_attribute(header, "screenWindowWidth", "float", value);
+    value.clear();
+    put(value, 0.f);
+    put(value, 0.f);
+    put_attribute(header, "screenWindowCenter", "v2f", value);
+
+    if (tile_size > 0){
+        std::vector<char> tiles;
+        put(tiles, (uint32_t) tile_size);
+        put(tiles, (uint32_t) tile_size);
+        tiles.push_back(0);
+        put_attribute(header, "tiles", "tiledesc", tiles);
+    }
+    header.push_back('\0');
+    return header;
+}
+
+//rows [y0, y1) of width pixels, each row holding every channel in turn, optionally compressed
+static std::vector<unsigned char> exr_block(const std::vector<const ImageChannel*>& channels, int width, int y0, int y1, bool half, ExrCompression compression){
+    size_t bytes_per_value = half ? 2 : 4;
+    std::vector<unsigned char> raw((size_t) (y1 - y0) * width * channels.size() * bytes_per_value);
+    unsigned char* out = raw.data();
+    for (int y = y0; y < y1; y++){
+        for (const ImageChannel* channel : channels){
+            const float* row = channel->data.data() + (size_t) y * width;
+            for (int x = 0; x < width; x++){
+                if (half){
+                    uint16_t h = glm::packHalf1x16(row[x]);
+                    std::memcpy(out, &h, 2);
+                } else {
+                    std::memcpy(out, &row[x], 4);
+                }
+                out += bytes_per_value;
+            }
+        }
+    }
+    return compression == ExrCompression::None ? raw : zip_block(raw);
+}
+
+static std::vector<const ImageChannel*> sorted_channels(const std::vector<ImageChannel>& channels){
+    std::vector<const ImageChannel*> sorted;
+    for (const ImageChannel& channel : channels){
+        sorted.push_back(&channel);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const ImageChannel* a, const ImageChannel* b){
+        return a->name < b->name;
+    });
+    return sorted;
+}
+
+bool write_exr(const std::string& path, int width, int height, const std::vector<ImageChannel>& channels, bool half, ExrCompression compression){
+    std::vector<const ImageChannel*> sorted = sorted_channels(channels);
+    std::vector<std::string> names;
+    for (const ImageChannel* channel : sorted){
+        names.push_back(channel->name);
+    }
+    std::vector<char> header = exr_header(width, height, names, half, compression, 0);
+
+    int lines_per_block = compression == ExrCompression::Zip ? 16 : 1;
+    int n_blocks = (height + lines_per_block - 1) / lines_per_block;
+
+    //blocks are packed and compressed in parallel
+    std::vector<std::vector<unsigned char>> blocks(n_blocks);
+    ThreadPool::global().parallel_for(0, n_blocks, 1, [&](int begin, int end){
+        for (int b = begin; b < end; b++){
+            int y0 = b * lines_per_block;
+            blocks[b] = exr_block(sorted, width, y0, std::min(y0 + lines_per_block, height), half, compression);
+        }
+    });
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file){
+        return false;
+    }
+    file.write(header.data(), header.size());
+
+    uint64_t offset = header.size() + (uint64_t) n_blocks * 8;
+    for (const std::vector<unsigned char>& block : blocks){
+        file.write((const char*) &offset, 8);
+        offset += 8 + block.size();
+    }
+    for (int b = 0; b < n_blocks; b++){
+        int32_t y = b * lines_per_block;
+        int32_t size = blocks[b].size();
+        file.write((const char*) &y, 4);
+        file.write((const char*) &size, 4);
+        file.write((const char*) blocks[b].data(), size);
+    }
+    return (bool) file;
+}
+
+ExrTileWriter::~ExrTileWriter(){
+    this->close();
+}
+
+bool ExrTileWriter::open(const std::string& path, int width, int height, int tile_size, const std::vector<std::string>& channel_names, bool half, ExrCompression compression){
+    this->file.open(path, std::ios::binary);
+    if (!this->file){
+        return false;
+    }
+    this->tile_size = tile_size;
+    this->half = half;
+    this->compression = compression;
+    this->tiles_x = (width + tile_size - 1) / tile_size;
+    this->tiles_y = (height + tile_size - 1) / tile_size;
+    this->offsets.assign(this->tiles_x * this->tiles_y, 0);
+
+    std::vector<std::string> names = channel_names;
+    std::sort(names.begin(), names.end());
+    std::vector<char> header = exr_header(width, height, names, half, compression, tile_size);
+    this->file.write(header.data(), header.size());
+
+    //placeholder offset table, filled in by close()
+    this->table_position = header.size();
+    this->end = this->table_position + this->offsets.size() * 8;
+    this->file.write((const char*) this->offsets.data(), this->offsets.size() * 8);
+    return (bool) this->file;
+}
+
+bool ExrTileWriter::write_tile(int x, int y, int w, int h, const std::vector<ImageChannel>& channels){
+    int tx = x / this->tile_size;
+    int ty = y / this->tile_size;
+    std::vector<unsigned char> block = exr_block(sorted_channels(channels), w, 0, h, this->half, this->compression);
+
+    std::lock_guard<std::mutex> guard(this->mutex);
+    if (!this->file.is_open()){
+        return false;
+    }
+    int32_t chunk[5] = {tx, ty, 0, 0, (int32_t) block.size()};
+    this->offsets[ty * this->tiles_x + tx] = this->end;
+    this->file.write((const char*) chunk, sizeof(chunk));
+    this->file.write((const char*) block.data(), block.size());
+    this->end += sizeof(chunk) + block.size();
+    return (bool) this->file;
+}
+
+bool ExrTileWriter::close(){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    if (!this->file.is_open()){
+        return false;
+    }
+    this->file.seekp(this->table_position);
+    this->file.write((const char*) this->offsets.data(), this->offsets.size() * 8);
+    bool ok = (bool) this->file;
+    this->file.close();
+    return ok;
+}
+
+bool write_pfm(const std::string& path, int width, int height, const std::vector<const ImageChannel*>& channels){
+    if (channels.size() != 1 && channels.size() != 3){
+        return false;
+    }
+    std::ofstream file(path, std::ios::binary);
+    if (!file){
+        return false;
+    }
+    file << (channels.size() == 3 ? "PF" : "Pf") << "\n" << width << " " << height << "\n-1.0\n";
+
+    //rows are stored bottom to top
+    std::vector<float> row(width * channels.size());
+    for (int y = height - 1; y >= 0; y--){
+        for (int x = 0; x < width; x++){
+            for (size_t c = 0; c < channels.size(); c++){
+                row[x * channels.size() + c] = channels[c]->data[(size_t) y * width + x];
+            }
+        }
+        file.write((const char*) row.data(), row.size() * sizeof(float));
+    }
+    return (bool) file;
+}
@@ -0,0 +1,57 @@
+#ifndef IMAGE_IO_H_
+#define IMAGE_IO_H_
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+
+//one float per pixel, rows top to bottom
+struct ImageChannel {
+    std::string name;
+    std::vector<float> data;
+};
+
+enum class ExrCompression { None, Zips, Zip };
+
+/*
+Scanline OpenEXR writer for a single part image. Channels are stored as half
+or 32 bit float, uncompressed or zlib compressed one (ZIPS) or sixteen (ZIP)
+scanlines at a time. Assumes a little endian host like the rest of the
+file formats here.
+*/
+bool write_exr(const std::string& path, int width, int height, const std::vector<ImageChannel>& channels, bool half, ExrCompression compression);
+
+/*
+Tiled OpenEXR file written tile by tile in any order, for streaming finished
+render tiles to disk. Tiles are compressed by the calling thread and appended
+under a lock; the offset table is filled in when the file is closed.
+*/
+class ExrTileWriter {
+    public:
+        ExrTileWriter(){}
+        ~ExrTileWriter();
+
+        bool open(const std::string& path, int width, int height, int tile_size, const std::vector<std::string>& channel_names, bool half, ExrCompression compression);
+        //(x, y) is the tile's top left pixel, channels hold w * h values
+        bool write_tile(int x, int y, int w, int h, const std::vector<ImageChannel>& channels);
+        bool close();
+
+    private:
+        std::ofstream file;
+        std::mutex mutex;
+        int tile_size = 0;
+        int tiles_x = 0;
+        int tiles_y = 0;
+        bool half = true;
+        ExrCompression compression = ExrCompression::Zip;
+        std::vector<uint64_t> offsets;
+        uint64_t table_position = 0;
+        uint64_t end = 0;
+};
+
+//portable float map, 3 channels give a color "PF" file, 1 channel a greyscale "Pf" one
+bool write_pfm(const std::string& path, int width, int height, const std::vector<const ImageChannel*>& channels);
+
+#endif
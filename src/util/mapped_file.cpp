@@ -0,0 +1,38 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util/mapped_file.h"
+
+bool MappedFile::open(const std::string& path){
+    this->close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0){
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0){
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (mapped == MAP_FAILED){
+        return false;
+    }
+    //assets are parsed front to back
+    madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+    this->bytes = (const unsigned char*) mapped;
+    this->length = info.st_size;
+    return true;
+}
+
+void MappedFile::close(){
+    if (this->bytes != nullptr){
+        munmap((void*) this->bytes, this->length);
+        this->bytes = nullptr;
+        this->length = 0;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <string>
+#include <cstddef>
+
+/*
+Read only memory mapping of a whole file, so large assets are paged in by
+the kernel as they are parsed instead of being read into a buffer first.
+Unmapped when closed or destroyed.
+*/
+class MappedFile {
+    public:
+        MappedFile(){}
+        ~MappedFile(){ this->close(); }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        //false if the file can't be opened or is empty
+        bool open(const std::string& path);
+        void close();
+        const unsigned char* data() const { return this->bytes; }
+        size_t size() const { return this->length; }
+
+    private:
+        const unsigned char* bytes = nullptr;
+        size_t length = 0;
+};
+
+#endif
@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <random>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
 
 #include "glm/glm.hpp"  
 #include <glm/gtx/transform.hpp> 
@@ -11,11 +14,44 @@
 #define PI 3.1415926535897932384626433832795f
 
 
+//generator behind randuf, one per thread
+inline std::minstd_rand& rng(){
+    static thread_local std::minstd_rand gen(2.0f);
+    return gen;
+}
+
+inline uint32_t hash_u32(uint32_t h){
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/*
+Reseeds the calling thread's generator from a pixel and sample index, so a
+pixel sample draws the same numbers whichever thread, tile order or machine
+renders it. stream separates independent uses within one sample, frame
+the frames of a batch render.
+*/
+inline void seed_sample(int x, int y, int sample, int stream = 0, int frame = 0){
+    uint32_t h = hash_u32(x * 0x9e3779b9u + hash_u32(y));
+    h = hash_u32(h + hash_u32(sample * 4 + stream));
+    if (frame != 0){
+        h = hash_u32(h + hash_u32(frame * 0x9e3779b9u));
+    }
+    rng().seed(h);
+}
+
 inline float randuf(){
-    static thread_local std::random_device rd;
-    static std::minstd_rand gen(2.0f);
     static std::uniform_real_distribution<float> dist(0, 1);
-    return dist(gen);
+    return dist(rng());
+}
+
+
+inline float luminance(const glm::vec3& c){
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
 }
 
 
@@ -24,6 +60,33 @@ inline glm::vec3 vector_to_vec3(const std::vector<float>& v){
 }
 
 
+/*
+Octahedral mapping of a unit vector onto [-1, 1]^2 (Cigolle et al. 2014),
+stored as two 16 bit snorms it is within about 1e-4 of the original
+direction. Vectors that aren't finite map to +z.
+*/
+inline glm::vec2 oct_encode(glm::vec3 n){
+    float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (!(l1 > 0.f) || !std::isfinite(l1)){
+        return glm::vec2(0.f);
+    }
+    n /= l1;
+    glm::vec2 p(n.x, n.y);
+    if (n.z < 0.f){
+        p = (1.f - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f);
+    }
+    return p;
+}
+
+inline glm::vec3 oct_decode(glm::vec2 p){
+    glm::vec3 n(p.x, p.y, 1.f - std::abs(p.x) - std::abs(p.y));
+    float t = std::max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return glm::normalize(n);
+}
+
+
 inline glm::vec3 sampleSphereUniform(float r1, float r2){
     float z = r1 * 2 - 1;
     float t = r2 * 2 * 3.1415f;
@@ -0,0 +1,95 @@
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "util/numa.h"
+
+NumaTopology NumaTopology::detect(){
+    NumaTopology topology;
+
+    for (int node = 0; ; node++){
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file){
+            break;
+        }
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> cpus = parse_cpu_list(list);
+        if (!cpus.empty()){
+            topology.nodes.push_back(cpus);
+        }
+    }
+
+    if (topology.nodes.empty()){
+        std::vector<int> cpus;
+        for (int i = 0; i < (int) std::thread::hardware_concurrency(); i++){
+            cpus.push_back(i);
+        }
+        topology.nodes.push_back(cpus);
+    }
+    return topology;
+}
+
+//parses lists like "0-15,32-47"
+std::vector<int> parse_cpu_list(const std::string& list){
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')){
+        if (range.empty()){
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++){
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+bool pin_current_thread(const std::vector<int>& cpus){
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus){
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+std::vector<int> current_thread_cpus(){
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) == 0){
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+            if (CPU_ISSET(cpu, &set)){
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    return cpus;
+}
+
+ScopedThreadPin::ScopedThreadPin(const std::vector<int>& cpus){
+    this->previous = current_thread_cpus();
+    pin_current_thread(cpus);
+}
+
+ScopedThreadPin::~ScopedThreadPin(){
+    if (!this->previous.empty()){
+        pin_current_thread(this->previous);
+    }
+}
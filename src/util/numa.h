@@ -0,0 +1,44 @@
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <vector>
+#include <string>
+
+/*
+NUMA nodes and their cpus as reported by /sys/devices/system/node. Falls
+back to a single node holding every cpu where that isn't available.
+*/
+class NumaTopology {
+    public:
+        std::vector<std::vector<int>> nodes;
+
+        NumaTopology(){}
+        static NumaTopology detect();
+
+        //node of a render thread, threads are spread over nodes in contiguous blocks
+        int node_of_thread(int thread, int num_threads) const {
+            return (int) ((long long) thread * this->nodes.size() / num_threads);
+        }
+};
+
+std::vector<int> parse_cpu_list(const std::string& list);
+
+//restricts the calling thread to the given cpus, returns false if unsupported
+bool pin_current_thread(const std::vector<int>& cpus);
+//cpus the calling thread may run on, empty if unsupported
+std::vector<int> current_thread_cpus();
+
+/*
+Pins the calling thread for the lifetime of the object and restores its
+previous affinity afterwards, for pool threads that only render pinned.
+*/
+class ScopedThreadPin {
+    public:
+        ScopedThreadPin(const std::vector<int>& cpus);
+        ~ScopedThreadPin();
+
+    private:
+        std::vector<int> previous;
+};
+
+#endif
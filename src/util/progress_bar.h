@@ -6,7 +6,7 @@
 #include <chrono>
 #include <iostream>
 
-double currentTimeMilliseconds(){
+inline double currentTimeMilliseconds(){
     auto now = std::chrono::high_resolution_clock::now().time_since_epoch();
     return (double) std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
 }
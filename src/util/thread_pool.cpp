@@ -0,0 +1,137 @@
+#include <algorithm>
+
+#include "util/thread_pool.h"
+
+std::unique_ptr<ThreadPool> ThreadPool::global_pool;
+
+ThreadPool::ThreadPool(int num_threads){
+    for (int i = 0; i < std::max(num_threads, 1); i++){
+        this->threads.push_back(std::thread(&ThreadPool::worker, this));
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> guard(this->tasks_mutex);
+        this->stop = true;
+        this->tasks_con.notify_all();
+    }
+    for (auto &t : this->threads){
+        t.join();
+    }
+}
+
+ThreadPool& ThreadPool::global(){
+    if (!global_pool){
+        global_pool.reset(new ThreadPool(std::thread::hardware_concurrency()));
+    }
+    return *global_pool;
+}
+
+void ThreadPool::init(int num_threads){
+    global_pool.reset(new ThreadPool(num_threads));
+}
+
+void ThreadPool::submit(std::function<void()> task){
+    std::lock_guard<std::mutex> guard(this->tasks_mutex);
+    this->tasks.push_back(std::move(task));
+    this->tasks_con.notify_one();
+}
+
+bool ThreadPool::run_pending(){
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> guard(this->tasks_mutex);
+        if (this->tasks.empty()){
+            return false;
+        }
+        task = std::move(this->tasks.front());
+        this->tasks.pop_front();
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::worker(){
+    while (true){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(this->tasks_mutex);
+            while (this->tasks.empty() && !this->stop){
+                this->tasks_con.wait(lock);
+            }
+            if (this->tasks.empty() && this->stop){
+                return;
+            }
+            task = std::move(this->tasks.front());
+            this->tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallel_for(int begin, int end, int grain, const std::function<void(int, int)>& body){
+    int n = end - begin;
+    if (n <= 0){
+        return;
+    }
+    int chunk = std::max(grain, n / (this->size() * 4) + 1);
+    if (chunk >= n){
+        body(begin, end);
+        return;
+    }
+
+    TaskGroup group(*this);
+    for (int i = begin; i < end; i += chunk){
+        int chunk_end = std::min(i + chunk, end);
+        group.run([&body, i, chunk_end](){ body(i, chunk_end); });
+    }
+    group.wait();
+}
+
+
+void TaskGroup::run(std::function<void()> task){
+    this->pending.fetch_add(1);
+    this->pool.submit([this, task](){
+        std::exception_ptr error;
+        try {
+            task();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> guard(this->done_mutex);
+        if (error && !this->error){
+            this->error = error;
+        }
+        this->pending.fetch_sub(1);
+        this->done_con.notify_all();
+    });
+}
+
+void TaskGroup::wait(){
+    this->wait_pending();
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> guard(this->done_mutex);
+        std::swap(error, this->error);
+    }
+    if (error){
+        std::rethrow_exception(error);
+    }
+}
+
+void TaskGroup::wait_pending(){
+    while (this->pending.load() > 0){
+        if (this->pool.run_pending()){
+            continue;
+        }
+        //nothing to help with, sleep until a task of this group finishes. The
+        //timeout picks up tasks queued meanwhile by nested groups
+        std::unique_lock<std::mutex> lock(this->done_mutex);
+        if (this->pending.load() > 0){
+            this->done_con.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+    //the last task may still be notifying, it releases the mutex when done
+    std::lock_guard<std::mutex> guard(this->done_mutex);
+}
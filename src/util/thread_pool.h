@@ -0,0 +1,73 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <condition_variable>
+
+class TaskGroup;
+
+/*
+Persistent pool of worker threads shared by scene loading, BVH build,
+rendering and image output, so threads are started once per process.
+Threads waiting on a task group run queued tasks instead of blocking, which
+makes nested parallelism (e.g. parallel_for inside a task) safe.
+*/
+class ThreadPool {
+    public:
+        ThreadPool(int num_threads);
+        ~ThreadPool();
+
+        //process wide pool, created with hardware_concurrency threads unless init was called first
+        static ThreadPool& global();
+        static void init(int num_threads);
+
+        int size() const { return this->threads.size(); }
+        void submit(std::function<void()> task);
+        //runs one queued task on the calling thread, returns false if the queue was empty
+        bool run_pending();
+        //calls body(begin, end) on chunks of [begin, end) of at least grain iterations
+        void parallel_for(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+    private:
+        std::vector<std::thread> threads;
+        std::deque<std::function<void()>> tasks;
+        std::mutex tasks_mutex;
+        std::condition_variable tasks_con;
+        bool stop = false;
+
+        void worker();
+        static std::unique_ptr<ThreadPool> global_pool;
+};
+
+/*
+Tasks run on the pool and are waited for together. The first exception thrown
+by a task is kept and rethrown by wait(), the remaining tasks still run.
+*/
+class TaskGroup {
+    public:
+        TaskGroup(ThreadPool& pool): pool(pool), pending(0){}
+        //doesn't rethrow, the group may be unwinding already
+        ~TaskGroup(){ this->wait_pending(); }
+
+        void run(std::function<void()> task);
+        void wait();
+
+    private:
+        ThreadPool& pool;
+        std::atomic<int> pending;
+        std::mutex done_mutex;
+        std::condition_variable done_con;
+        std::exception_ptr error;
+
+        void wait_pending();
+};
+
+#endif